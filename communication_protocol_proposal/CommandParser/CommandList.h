@@ -0,0 +1,68 @@
+/**
+ * CommandList.h - List of the commands of the COXIRIS Positioning System
+ *                 command parser.
+ *
+ * This is the only place where a command is written down. The CommandId enum,
+ * the descriptor table and the flash resident names, usages and help texts
+ * are all generated from this list, so they can not get out of step.
+ */
+
+ #ifndef COMMAND_LIST_H
+ #define COMMAND_LIST_H
+
+ /**
+  * One X(...) row per command, in CommandId order:
+  * X(name, handler, arity, argumentType, results, decimals, usage, help)
+  *
+  * name         Command token, also gives CMD_<name>
+  * handler      HandlerType, how the parser runs the command
+  * arity        Number of arguments (HANDLER_SET_VALUES, HANDLER_MOVE and the built-ins that take one)
+  * argumentType ArgumentType of every argument
+  * results      Number of returned values (HANDLER_GET_VALUES)
+  * decimals     Decimals used to print the returned values
+  * usage        Command with its arguments, as shown in help()
+  * help         Description shown in help()
+  */
+ #define COMMAND_LIST(X) \
+   X(HELP, HANDLER_HELP, 0, ARG_NONE, 0, 0, \
+     "HELP", "Displays this help message") \
+   X(SET_HOME, HANDLER_VOID, 0, ARG_NONE, 0, 0, \
+     "SET_HOME", "Sets current position as home (0,0,0)") \
+   X(GO_HOME, HANDLER_MOVE, 0, ARG_NONE, 0, 0, \
+     "GO_HOME", "Moves to home position (0,0,0)") \
+   X(ABSOLUTE_MOVE, HANDLER_MOVE, 3, ARG_NUMBER, 0, 0, \
+     "ABSOLUTE_MOVE x y z", "Moves to absolute position x, y, z") \
+   X(DELTA_MOVE, HANDLER_MOVE, 3, ARG_NUMBER, 0, 0, \
+     "DELTA_MOVE dx dy dz", "Moves relative to current position by dx, dy, dz") \
+   X(GET_POSITION, HANDLER_GET_VALUES, 0, ARG_NONE, 3, 2, \
+     "GET_POSITION", "Returns current position") \
+   X(SET_SPEED, HANDLER_SET_VALUES, 1, ARG_POSITIVE_NUMBER, 0, 0, \
+     "SET_SPEED speed", "Sets movement speed to speed in mm/s") \
+   X(GET_SPEED, HANDLER_GET_VALUES, 0, ARG_NONE, 1, 0, \
+     "GET_SPEED", "Returns current movement speed in mm/s") \
+   X(GET_MIN_SPEED, HANDLER_GET_VALUES, 0, ARG_NONE, 1, 0, \
+     "GET_MIN_SPEED", "Returns minimum allowed movement speed in mm/s") \
+   X(GET_MAX_SPEED, HANDLER_GET_VALUES, 0, ARG_NONE, 1, 0, \
+     "GET_MAX_SPEED", "Returns maximum allowed movement speed in mm/s") \
+   X(GET_ID, HANDLER_ID, 0, ARG_NONE, 0, 0, \
+     "GET_ID", "Returns the unique device identifier") \
+   X(CHECK_ERRORS, HANDLER_VOID, 0, ARG_NONE, 0, 0, \
+     "CHECK_ERRORS", "Performs system diagnostics and reports any errors") \
+   X(BINARY, HANDLER_BINARY, 0, ARG_NONE, 0, 0, \
+     "BINARY", "Switches to binary frames, a BINARY frame switches back to text") \
+   X(PATH, HANDLER_PATH, 0, ARG_NONE, 0, 0, \
+     "PATH", "Queues a batch of absolute moves, sent as one binary frame") \
+   X(SET_BAUD, HANDLER_SET_BAUD, 1, ARG_POSITIVE_NUMBER, 0, 0, \
+     "SET_BAUD rate", "Switches to rate, KEEP_BAUD must follow at the new rate") \
+   X(KEEP_BAUD, HANDLER_KEEP_BAUD, 0, ARG_NONE, 0, 0, \
+     "KEEP_BAUD", "Keeps the rate set by SET_BAUD, which otherwise falls back") \
+   X(GET_BAUD_RATES, HANDLER_BAUD_RATES, 0, ARG_NONE, 0, 0, \
+     "GET_BAUD_RATES", "Returns the supported baud rates") \
+   X(STREAM_POSITION, HANDLER_STREAM, 1, ARG_POSITIVE_NUMBER, 0, 0, \
+     "STREAM_POSITION hz", "Sends the position hz times per second until STOP_STREAM") \
+   X(STOP_STREAM, HANDLER_STOP_STREAM, 0, ARG_NONE, 0, 0, \
+     "STOP_STREAM", "Stops the position stream and returns the dropped samples") \
+   X(GET_STATS, HANDLER_STATS, 0, ARG_NONE, 0, 0, \
+     "GET_STATS", "Returns the receive and run latency histograms of every command")
+
+ #endif
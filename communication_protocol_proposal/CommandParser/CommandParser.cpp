@@ -9,405 +9,1444 @@
  */
 
  #include "CommandParser.h"
+ #include "CommandTable.h"
+ #include "NumberFormatter.h"
+
+ // Longest bare DONE line: tag + "DONE " + name + "\r\n", longer than a DONE frame
+ #define BARE_DONE_SIZE (TAG_PREFIX_SIZE + 5 + COMMAND_NAME_SIZE + 2)
+
+ // Baud rates accepted by SET_BAUD and returned by GET_BAUD_RATES
+ static constexpr uint32_t BAUD_RATES[] PROGMEM = { SERIAL_BAUD_RATES };
+ #define BAUD_RATE_COUNT (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
+
+ /**
+  * Finds the highest rate accepted by SET_BAUD, at compile time.
+  *
+  * @param index First rate to check
+  * @param highest Highest rate found before index
+  * @return The highest of SERIAL_BAUD_RATES
+  */
+ static constexpr uint32_t highestBaudRate(uint8_t index = 0, uint32_t highest = 0) {
+   return index == BAUD_RATE_COUNT ? highest :
+          highestBaudRate(index + 1, BAUD_RATES[index] > highest ? BAUD_RATES[index] : highest);
+ }
+
+ // Longest ACK or DONE frame contents: kind + tag + command + one int32 per
+ // value, or one uint32 per baud rate
+ #define REPLY_FRAME_SIZE (3 + 1 + (BAUD_RATE_COUNT > MAX_ARGUMENTS ? BAUD_RATE_COUNT : MAX_ARGUMENTS) * 4)
+
+ // Longest DONE line: tag + "DONE " + name + ":" + one " value" per result + "\r\n"
+ static_assert(TAG_PREFIX_SIZE + 5 + COMMAND_NAME_SIZE + 1 + MAX_ARGUMENTS * (1 + NUMBER_FORMAT_SIZE) + 3 <= RESPONSE_LINE_SIZE,
+               "RESPONSE_LINE_SIZE is too small for a DONE line");
+ static_assert(TAG_PREFIX_SIZE + 5 + COMMAND_NAME_SIZE + 1 + BAUD_RATE_COUNT * (1 + 7) + 3 <= RESPONSE_LINE_SIZE,
+               "RESPONSE_LINE_SIZE is too small for the GET_BAUD_RATES line");
+ static_assert(sizeof(DEVICE_ID) - 1 <= MAX_ARGUMENTS * 4, "DEVICE_ID must fit in a DONE frame");
+ static_assert(TAG_PREFIX_SIZE >= 4, "The frame header is written in the room kept for the tag");
+
+ #if COMMAND_PARSER_STATS
+ // Longest GET_STATS line: tag + "STATS " + name + " RECEIVE " + first bucket + ":" + one " count" per bucket + "\r\n"
+ static_assert(TAG_PREFIX_SIZE + 6 + COMMAND_NAME_SIZE + 9 + 2 + 1 + STATS_BUCKETS * 6 + 3 <= RESPONSE_LINE_SIZE,
+               "RESPONSE_LINE_SIZE is too small for a GET_STATS line");
+ #endif
+
+ // Longest position sample line: tag + "POSITION:" + one " value" per axis + "\r\n"
+ #define SAMPLE_LINE_SIZE (TAG_PREFIX_SIZE + 9 + MAX_ARGUMENTS * (1 + NUMBER_FORMAT_SIZE) + 2)
+
+ /**
+  * Helper function to compute the fixed point scale, 10^decimals.
+  *
+  * @param decimals Number of decimals
+  * @return The scale
+  */
+ static constexpr int32_t fixedScale(uint8_t decimals) {
+   return decimals == 0 ? 1 : 10 * fixedScale(decimals - 1);
+ }
+
+ /**
+  * Helper function to check if SET_BAUD accepts a rate.
+  *
+  * @param rate The rate
+  * @return true if it is one of SERIAL_BAUD_RATES
+  */
+ static bool baudSupported(uint32_t rate) {
+   for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) {
+     if (pgm_read_dword(&BAUD_RATES[i]) == rate) {
+       return true;
+     }
+   }
+   return false;
+ }
+
+ /**
+  * Helper function to convert a fixed point SET_BAUD argument to a rate.
+  *
+  * @param value The argument, FIXED_POINT_DECIMALS decimals
+  * @return The rate, or 0 if it is not a whole number
+  */
+ static uint32_t baudArgument(int32_t value) {
+   return value % fixedScale(FIXED_POINT_DECIMALS) == 0 ? value / fixedScale(FIXED_POINT_DECIMALS) : 0;
+ }
+
+ #if !COMMAND_PARSER_FIXED_POINT
+ /**
+  * Helper function to convert a float SET_BAUD argument to a rate.
+  * The value is only cast once it is known to fit, so 1e30 is rejected
+  * instead of being undefined behaviour.
+  *
+  * @param value The argument
+  * @return The rate, or 0 if it is not a whole number or is above every
+  *         supported rate
+  */
+ static uint32_t baudArgument(float value) {
+   if (!(value >= 0 && value <= highestBaudRate()) || value != (float)(uint32_t)value) {
+     return 0;
+   }
+   return (uint32_t)value;
+ }
+ #endif
+
+ /**
+  * Helper function to store an int32 in a frame, little endian.
+  *
+  * @param bytes Where the 4 bytes are written
+  * @param value The value
+  */
+ static void putInt32(uint8_t* bytes, int32_t value) {
+   uint32_t bits = (uint32_t)value;
+   bytes[0] = bits;
+   bytes[1] = bits >> 8;
+   bytes[2] = bits >> 16;
+   bytes[3] = bits >> 24;
+ }
+
+ #if !COMMAND_PARSER_FIXED_POINT
+ /**
+  * Helper function to round a scaled float to an int32. Values beyond the
+  * int32 range are saturated and NaN gives 0, where a plain cast would be
+  * undefined behaviour.
+  *
+  * @param scaled The value, already multiplied by the fixed point scale
+  * @return The rounded value
+  */
+ static int32_t roundFixed(float scaled) {
+   if (isnan(scaled)) {
+     return 0;
+   }
+   if (scaled >= 2147483648.0f) {
+     return INT32_MAX;
+   }
+   if (scaled <= -2147483648.0f) {
+     return INT32_MIN;
+   }
+   return (int32_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+ }
+ #endif
+
+ /**
+  * Helper function to read a little endian int32 from a frame.
+  *
+  * @param bytes The 4 bytes
+  * @return The value
+  */
+ static int32_t getInt32(const uint8_t* bytes) {
+   return (int32_t)((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+ }
+
+ /**
+  * Helper function to write the kind and tag of a reply frame.
+  *
+  * @param frame The frame, its contents start at frame[1]
+  * @param kind FRAME_ACK, FRAME_DONE or FRAME_TEXT
+  * @param tag The tag of the command
+  * @param id The command
+  * @return Index of the next byte of the frame
+  */
+ static uint8_t startFrame(uint8_t* frame, uint8_t kind, uint16_t tag, uint8_t id) {
+   frame[1] = kind;
+   frame[2] = tag;
+   frame[3] = tag >> 8;
+   frame[4] = id;
+   return 5;
+ }
 
  /**
   * Initializes the serial communication with the specified baud rate.
   * Also sets the serial timeout for reading commands.
   */
- void CommandParser::begin() {
+ void CommandParserBase::begin() {
+   baudRate = SERIAL_BAUD;
+   baudPending = false;
    Serial.begin(SERIAL_BAUD);
    Serial.setTimeout(SERIAL_TIMEOUT);
+   tx.begin(Serial);
  }
- 
+
  /**
-  * Helper function to trim leading and trailing whitespace from a string.
-  * 
-  * @param str Pointer to the string to be trimmed
+  * Helper function to switch the serial port to a new baud rate.
+  * Everything queued is sent and transmitted at the current rate first, so
+  * the host receives the last replies before the switch intact.
+  *
+  * @param rate The new rate
   */
- void CommandParser::trim(char* str) {
-   // Null or empty string
-   if (str == NULL || *str == '\0') {
-     return;
+ void CommandParserBase::switchBaud(uint32_t rate) {
+   tx.flush();
+   Serial.flush();
+   baudRate = rate;
+   Serial.begin(rate);
+ }
+
+ /**
+  * Appends bytes to a response line, cutting them if the line is full.
+  */
+ CommandParserBase::ResponseLine& CommandParserBase::ResponseLine::append(const char* bytes, size_t count) {
+   size_t room = RESPONSE_LINE_SIZE - 3 - length;
+   if (count > room) {
+     count = room;
+   }
+   memcpy(text + length, bytes, count);
+   length += count;
+   return *this;
+ }
+
+ /**
+  * Appends bytes stored in flash to a response line, cutting them if the line is full.
+  */
+ CommandParserBase::ResponseLine& CommandParserBase::ResponseLine::append(const __FlashStringHelper* bytes, size_t count) {
+   size_t room = RESPONSE_LINE_SIZE - 3 - length;
+   if (count > room) {
+     count = room;
    }
-   // Trim leading spaces
-   while (isspace(*str)) {
-     memmove(str, str + 1, strlen(str)); // Shift the string to the left
+   memcpy_P(text + length, bytes, count);
+   length += count;
+   return *this;
+ }
+
+ /**
+  * Appends an unsigned integer to a response line.
+  */
+ CommandParserBase::ResponseLine& CommandParserBase::ResponseLine::appendUnsigned(uint32_t value) {
+   char digits[NUMBER_FORMAT_SIZE];
+   return append(digits, NumberFormatter::formatUnsigned(digits, value));
+ }
+
+ /**
+  * Appends ":" and the values returned by a callback to a response line.
+  * The numbers are formatted in place, the static_asserts above keep them in bounds.
+  */
+ CommandParserBase::ResponseLine& CommandParserBase::ResponseLine::appendValues(const Value* values, uint8_t count,
+                                                                                uint8_t decimals, bool useInts) {
+   text[length++] = ':';
+ #if COMMAND_PARSER_FIXED_POINT
+   (void)useInts;  // The values are always fixed point
+ #endif
+   for (uint8_t i = 0; i < count; i++) {
+     text[length++] = ' ';
+ #if !COMMAND_PARSER_FIXED_POINT
+     if (!useInts) {
+       length += NumberFormatter::formatFloat(text + length, values[i].real, decimals);
+       continue;
+     }
+ #endif
+     length += NumberFormatter::formatFixed(text + length, values[i].fixed, FIXED_POINT_DECIMALS, decimals);
    }
-   // Trim trailing spaces
-   int len = strlen(str);
-   int i = len - 1;
-   while (i >= 0 && isspace(str[i])) {
-     str[i] = '\0'; // Replace trailing spaces with null terminator
-     i--;
+   return *this;
+ }
+
+ /**
+  * Helper function to store the values returned by a callback in a frame.
+  */
+ uint8_t CommandParserBase::putValues(uint8_t* bytes, const Value* values, uint8_t count, bool useInts) {
+ #if COMMAND_PARSER_FIXED_POINT
+   (void)useInts;  // The values are always fixed point
+ #endif
+   for (uint8_t i = 0; i < count; i++) {
+ #if !COMMAND_PARSER_FIXED_POINT
+     if (!useInts) {
+       putInt32(bytes + i * 4, roundFixed(values[i].real * fixedScale(FIXED_POINT_DECIMALS)));
+       continue;
+     }
+ #endif
+     putInt32(bytes + i * 4, values[i].fixed);
    }
+   return count * 4;
  }
- 
+
  /**
-  * Helper function to convert a string to uppercase.
-  * 
-  * @param str Pointer to the string to be converted
+  * Helper function to terminate a line and queue it with one write, so the
+  * ring never holds half a line. The "#17 " prefix is written right before the
+  * text, in the room kept for it, so the text is never moved. In binary mode
+  * that room holds the frame header instead.
+  *
+  * @param line The line, without "\r\n"
+  * @return true if the line was queued, false if it was dropped
   */
- void CommandParser::convertToUppercase(char* str) {
-   if (str == nullptr) {
-     return;
+ bool CommandParserBase::sendLine(ResponseLine& line) {
+   if (binaryMode) {
+     uint8_t* frame = (uint8_t*)line.text + TAG_PREFIX_SIZE - 4;
+     frame[1] = FRAME_TEXT;
+     frame[2] = line.tag;
+     frame[3] = line.tag >> 8;
+     return sendFrame(frame, 3 + line.length - TAG_PREFIX_SIZE);
    }
-   for (int i = 0; str[i] != '\0'; i++) {
-     str[i] = toupper(str[i]);
+   uint8_t start = TAG_PREFIX_SIZE;
+   if (line.tag != COMMAND_NO_TAG) {
+     char digits[NUMBER_FORMAT_SIZE];
+     uint8_t count = NumberFormatter::formatUnsigned(digits, line.tag);
+     start -= count + 2;
+     line.text[start] = '#';
+     memcpy(line.text + start + 1, digits, count);
+     line.text[start + count + 1] = ' ';
    }
+   line.text[line.length++] = '\r';
+   line.text[line.length++] = '\n';
+   return tx.write(line.text + start, line.length - start);
+ }
+
+ /**
+  * Helper function to add the CRC to a frame, encode it and queue it with one
+  * write. The frame is encoded in place, so it costs no second buffer.
+  *
+  * @param frame The frame, its contents start at frame[1] and 3 bytes after
+  *              them are free
+  * @param length Number of bytes in the frame contents
+  * @return true if the frame was queued, false if it was dropped
+  */
+ bool CommandParserBase::sendFrame(uint8_t* frame, uint8_t length) {
+   uint16_t crc = FrameCodec::crc16(frame + 1, length);
+   frame[length + 1] = crc;
+   frame[length + 2] = crc >> 8;
+   return tx.write((const char*)frame, FrameCodec::encode(frame, length + 2));
+ }
+
+ /**
+  * Sends an error message following the protocol format.
+  */
+ void CommandParserBase::reportError(const char* errorMessage) {
+   ResponseLine line(responseTag);
+   sendLine(line.append(F("ERROR: ")).append(errorMessage));
+ }
+
+ /**
+  * Sends an error message stored in flash following the protocol format.
+  */
+ void CommandParserBase::reportError(const __FlashStringHelper* errorMessage) {
+   ResponseLine line(responseTag);
+   sendLine(line.append(F("ERROR: ")).append(errorMessage));
  }
  
  /**
-  * Helper function to check if a string is a valid number.
-  * Supports integers, decimals, and negative numbers.
-  * 
-  * @param str The string to be validated
-  * @return true if the string represents a valid number, false otherwise
-  */
- bool CommandParser::isValidNumber(const char* str) {
-   // Check if empty string
-   if(str == NULL || *str == '\0') return false;
-   
-   // Allow one minus or plus sign
-   if(*str == '-' || *str == '+') str++;
-   
-   // Must have at least one digit
-   bool hasDigit = false;
-   bool hasDecimal = false;
-   
-   while(*str != '\0') {
-     if(isdigit(*str)) {
-       hasDigit = true;
-     }
-     else if(*str == '.' && !hasDecimal) {
-       hasDecimal = true;
-     }
-     else {
-       return false;
-     }
-     str++;
+  * Resolves a command token to its identifier.
+  * The hash selects the only possible candidate, which is then confirmed
+  * with a single length check and memcmp.
+  *
+  * @param token The uppercase command token
+  * @param length The length of the token
+  * @return The command identifier, or CMD_UNKNOWN if there is no match
+  */
+ CommandParserBase::CommandId CommandParserBase::lookupCommand(const char* token, size_t length) {
+   if (length == 0) {
+     return CMD_UNKNOWN;
+   }
+   uint8_t id = pgm_read_byte(&COMMAND_SLOTS.ids[commandHash(token, length)]);
+   if (id == CMD_UNKNOWN || pgm_read_byte(&COMMANDS[id].nameLength) != length ||
+       memcmp_P(token, (PGM_P)pgm_read_ptr(&COMMANDS[id].name), length) != 0) {
+     return CMD_UNKNOWN;
    }
-   
-   return hasDigit;
+   return (CommandId)id;
  }
- 
+
+ /**
+  * Helper function to count the values a command exchanges with its callback.
+  *
+  * @param id The command
+  * @return Number of arguments plus number of returned values
+  */
+ static uint8_t valueCount(uint8_t id) {
+   const CommandDescriptor command = readCommand(id);
+   return command.arity + command.results;
+ }
+
  /**
-  * Configure the callback functions for various commands.
+  * Registers the callback of a command that takes no values.
   */
- void CommandParser::config(
+ bool CommandParserBase::on(CommandId id, VoidCallback callback) {
+   if (id >= CMD_COUNT || valueCount(id) != 0) {
+     return false;
+   }
+   uint8_t handler = pgm_read_byte(&COMMANDS[id].handler);
+   if (handler != HANDLER_VOID && handler != HANDLER_MOVE) {
+     return false;
+   }
+   callbacks[id].onVoid = callback;
+   return true;
+ }
+
+ /**
+  * Registers the callback of a command that exchanges three integer values.
+  */
+ bool CommandParserBase::on(CommandId id, ThreeIntsCallback callback) {
+   if (id >= CMD_COUNT || valueCount(id) != 3) {
+     return false;
+   }
+   callbacks[id].onThreeInts = callback;
+   callbackIsInt[id] = true;
+   return true;
+ }
+
+ /**
+  * Registers the callback of a command that exchanges one integer value.
+  */
+ bool CommandParserBase::on(CommandId id, IntCallback callback) {
+   if (id >= CMD_COUNT || valueCount(id) != 1) {
+     return false;
+   }
+   callbacks[id].onInt = callback;
+   callbackIsInt[id] = true;
+   return true;
+ }
+
+ #if !COMMAND_PARSER_FIXED_POINT
+ /**
+  * Registers the callback of a command that exchanges three values.
+  */
+ bool CommandParserBase::on(CommandId id, ThreeFloatsCallback callback) {
+   if (id >= CMD_COUNT || valueCount(id) != 3) {
+     return false;
+   }
+   callbacks[id].onThreeFloats = callback;
+   callbackIsInt[id] = false;
+   return true;
+ }
+
+ /**
+  * Registers the callback of a command that exchanges one value.
+  */
+ bool CommandParserBase::on(CommandId id, FloatCallback callback) {
+   if (id >= CMD_COUNT || valueCount(id) != 1) {
+     return false;
+   }
+   callbacks[id].onFloat = callback;
+   callbackIsInt[id] = false;
+   return true;
+ }
+
+ /**
+  * Configure the callback functions for the original set of commands.
+  */
+ void CommandParserBase::config(
   VoidCallback setHome,
   VoidCallback goHome,
   ThreeFloatsCallback absoluteMove,
   ThreeFloatsCallback deltaMove,
   ThreeFloatsCallback getPosition,
   FloatCallback setSpeed,
-  GetFloatCallback getSpeed,
-  GetFloatCallback getMinSpeed,
-  GetFloatCallback getMaxSpeed,
+  FloatCallback getSpeed,
+  FloatCallback getMinSpeed,
+  FloatCallback getMaxSpeed,
   VoidCallback checkErrors
 ) {
-   onSetHome = setHome;
-   onGoHome = goHome;
-   onAbsoluteMove = absoluteMove;
-   onDeltaMove = deltaMove;
-   onGetPosition = getPosition;
-   onSetSpeed = setSpeed;
-   onGetSpeed = getSpeed;
-   onGetMinSpeed = getMinSpeed;
-   onGetMaxSpeed = getMaxSpeed;
-   onCheckErrors = checkErrors;
+   on(CMD_SET_HOME, setHome);
+   on(CMD_GO_HOME, goHome);
+   on(CMD_ABSOLUTE_MOVE, absoluteMove);
+   on(CMD_DELTA_MOVE, deltaMove);
+   on(CMD_GET_POSITION, getPosition);
+   on(CMD_SET_SPEED, setSpeed);
+   on(CMD_GET_SPEED, getSpeed);
+   on(CMD_GET_MIN_SPEED, getMinSpeed);
+   on(CMD_GET_MAX_SPEED, getMaxSpeed);
+   on(CMD_CHECK_ERRORS, checkErrors);
  }
- 
- void CommandParser::processCommand() {
-   char* token = strtok(cmdBuffer, " ");
-   
-   if (token != NULL) {
-     // -----------------------------------------------------------------------------------------
-     // HELP 
-     // -----------------------------------------------------------------------------------------
-     if (strcmp(token, "HELP") == 0) {
-       Serial.println("ACK HELP");
-       help();
-       Serial.println("DONE HELP");
+ #endif
+
+ /**
+  * Helper function to close the token being received, if any.
+  * The command is resolved as soon as its token is complete, so arguments
+  * can be checked against its descriptor while they arrive.
+  */
+ void CommandParserBase::endToken() {
+   if (lineState == LINE_TAG) {
+     if (tagDigits == 0) {
+       tagDigits = TAG_INVALID;  // A '#' without digits
      }
-     // -----------------------------------------------------------------------------------------
-     // SET_HOME
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "SET_HOME") == 0) {
-       Serial.println("ACK SET_HOME");
-       if (onSetHome != nullptr) {
-         onSetHome();
-       } else {
-         this->reportError("SET_HOME function not configured");
+   }
+   else if (lineState == LINE_COMMAND) {
+     commandToken.length = cmdIndex - commandToken.start;
+     commandId = lookupCommand(cmdBuffer + commandToken.start, commandToken.length);
+   }
+   lineState = LINE_SEPARATOR;
+ }
+
+ /**
+  * Helper function to clear the line reader state for the next line.
+  */
+ void CommandParserBase::resetLine() {
+   cmdIndex = 0;
+   lineState = LINE_SEPARATOR;
+   lineTag = COMMAND_NO_TAG;
+   tagDigits = 0;
+   commandToken.length = 0;
+   commandId = CMD_UNKNOWN;
+   argumentCount = 0;
+ }
+
+ /**
+  * Helper function to validate and convert the arguments of the current command.
+  * The arguments were already parsed by the line reader, so only the final
+  * conversion is left, to fixed point integers if the callback takes them and
+  * to float otherwise. Nothing is sent here, so the ACK can report the queue
+  * depth knowing whether the command is accepted.
+  *
+  * @param values Array where the converted arguments are stored
+  * @param failed Set to the index of the argument that is not a valid number
+  * @return ARGUMENTS_OK if all the arguments are present and valid, the problem otherwise
+  */
+ CommandParserBase::ArgumentError CommandParserBase::convertArguments(Value* values, uint8_t& failed) {
+   const CommandDescriptor command = readCommand(commandId);
+   bool useInts = usesInts(commandId);
+   // Check if all parameters are present
+   if (argumentCount < command.arity) {
+     return ARGUMENTS_MISSING;
+   }
+   // Check if all parameters are valid numbers
+   for (uint8_t i = 0; i < command.arity; i++) {
+     NumberParser& number = arguments[i].number;
+     if (number.finish() != NumberParser::NUMBER_OK ||
+         (useInts && !number.toFixed(FIXED_POINT_DECIMALS, values[i].fixed))) {
+       failed = i;
+       return ARGUMENTS_INVALID;
+     }
+     bool positive;
+ #if COMMAND_PARSER_FIXED_POINT
+     positive = values[i].fixed > 0;
+ #else
+     if (useInts) {
+       positive = values[i].fixed > 0;
+     } else {
+       values[i].real = number.toFloat();
+       positive = values[i].real > 0;
+     }
+ #endif
+     if (command.argumentType == ARG_POSITIVE_NUMBER && !positive) {
+       return ARGUMENTS_NOT_POSITIVE;
+     }
+   }
+   return ARGUMENTS_OK;
+ }
+
+ /**
+  * Helper function to clear the values exchanged with a callback. They live
+  * in BasicCommandParser, one per argument token, and commands without a
+  * callback reply with them as zeros.
+  *
+  * @return The values, MAX_ARGUMENTS of them, all zero
+  */
+ CommandParserBase::Value* CommandParserBase::clearValues() {
+   memset(callbackValues, 0, MAX_ARGUMENTS * sizeof(Value));
+   return callbackValues;
+ }
+
+ /**
+  * Helper function to send the error of arguments that were rejected.
+  * Invalid numbers are reported with the argument and the character where
+  * parsing stopped, every error but the frame length one with the usage.
+  *
+  * @param id The command
+  * @param error The problem found by convertArguments() or processFrame()
+  * @param failed Index of the argument that is not a valid number
+  */
+ void CommandParserBase::reportArguments(CommandId id, ArgumentError error, uint8_t failed) {
+   const CommandDescriptor command = readCommand(id);
+   if (error == ARGUMENTS_LENGTH) {
+     reportError(F("Invalid payload length"));
+     return;
+   }
+   ResponseLine line(responseTag);
+   line.append(F("ERROR: "));
+   if (error == ARGUMENTS_MISSING) {
+     line.append(command.arity > 1 ? F("Missing parameters") : F("Missing parameter"));
+   } else if (error == ARGUMENTS_INVALID) {
+     // finish() keeps the status of a failed number, a number that finished
+     // fine was rejected by toFixed(), which only fails out of range
+     NumberParser& number = arguments[failed].number;
+     NumberParser::Status status = number.finish();
+     line.append(status == NumberParser::NUMBER_OK || status == NumberParser::NUMBER_OUT_OF_RANGE
+                     ? F("Number out of range") : F("Invalid number format"))
+         .append(F(" - Argument ")).appendUnsigned(failed + 1)
+         .append(F(", character ")).appendUnsigned(number.getErrorPosition() + 1);
+   } else {
+     line.append(F("Values must be positive"));
+   }
+   sendLine(line.append(F(" - Usage: ")).append(flashText(command.usage)));
+ }
+
+ /**
+  * Helper function to run the handler of a command and send its DONE reply.
+  * Commands without a registered callback report an error and, if they return
+  * values, reply with zeros. HELP replies once its last line has been sent,
+  * queued moves through finishMove() and callbacks that call defer() through
+  * complete().
+  *
+  * @param id The command being processed
+  * @param values The parsed arguments of the command
+  */
+ void CommandParserBase::runCommand(CommandId id, Value* values) {
+   const CommandDescriptor command = readCommand(id);
+   const Callback& callback = callbacks[id];
+   uint8_t count = command.arity + command.results;
+   bool useInts = usesInts(id);
+
+   switch (command.handler) {
+     case HANDLER_HELP:
+       startHelp(true);
+       return;
+     case HANDLER_ID:
+       break;
+     case HANDLER_BINARY:
+       recordDone(id);
+       sendDone(id, responseTag);
+       binaryMode = !binaryMode;  // After DONE, which is sent in the mode the command came in
+       return;
+     case HANDLER_PATH:
+       reportError(F("PATH is only accepted as a binary frame"));  // Frames go through queuePath()
+       break;
+     case HANDLER_SET_BAUD: {
+       // First phase: confirm at the old rate, then switch and wait for KEEP_BAUD.
+       // A fractional rate such as 115200.9 is rejected instead of being cut
+ #if COMMAND_PARSER_FIXED_POINT
+       uint32_t rate = baudArgument(values[0].fixed);
+ #else
+       uint32_t rate = useInts ? baudArgument(values[0].fixed) : baudArgument(values[0].real);
+ #endif
+       if (!baudSupported(rate)) {
+         reportError(F("Unsupported baud rate, see GET_BAUD_RATES"));
+         break;
        }
-       Serial.println("DONE SET_HOME");
+       recordDone(id);
+       sendDone(id, responseTag);
+       previousBaud = baudRate;
+       switchBaud(rate);
+       // The rest of this line and anything else received so far was sent at
+       // the old rate, so only a KEEP_BAUD sent after the switch is accepted
+       while (Serial.available() > 0) {
+         Serial.read();
+       }
+       baudPending = true;
+       baudDeadline = millis() + BAUD_CONFIRM_TIMEOUT;
+       return;
      }
-     // -----------------------------------------------------------------------------------------
-     // GO_HOME
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "GO_HOME") == 0) {
-       Serial.println("ACK GO_HOME");
-       if (onGoHome != nullptr) {
-         onGoHome();
+     case HANDLER_KEEP_BAUD:
+       baudPending = false;  // Second phase: the host got through at the new rate
+       break;
+     case HANDLER_BAUD_RATES:
+       break;
+     case HANDLER_STREAM: {
+       // The rate is kept in fixed point, so fractional rates such as 0.5 Hz work.
+       // A float above STREAM_MAX_RATE is rejected before it is scaled, as the
+       // cast of e.g. 1e30 would overflow
+ #if COMMAND_PARSER_FIXED_POINT
+       int32_t rate = values[0].fixed;
+ #else
+       int32_t rate = useInts ? values[0].fixed :
+                      !(values[0].real <= STREAM_MAX_RATE) ? 0 :
+                      (int32_t)(values[0].real * fixedScale(FIXED_POINT_DECIMALS) + 0.5f);
+ #endif
+       if (callbacks[CMD_GET_POSITION].onVoid == nullptr) {
+         reportError(F("GET_POSITION function not configured"));
+       } else if (rate <= 0 || rate > STREAM_MAX_RATE * fixedScale(FIXED_POINT_DECIMALS)) {
+         reportError(F("Stream rate out of range"));
        } else {
-         this->reportError("GO_HOME function not configured");
+         streamPeriod = 1000000UL * fixedScale(FIXED_POINT_DECIMALS) / (uint32_t)rate;
+         streamTag = responseTag;
+         droppedSamples = 0;
+         nextSample = micros();
        }
-       Serial.println("DONE GO_HOME");
+       break;
      }
-     // -----------------------------------------------------------------------------------------
-     // ABSOLUTE_MOVE
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "ABSOLUTE_MOVE") == 0) {
-       Serial.println("ACK ABSOLUTE_MOVE");
-       // Split the string using space as delimiter
-       char* x_str = strtok(NULL, " ");
-       char* y_str = strtok(NULL, " ");
-       char* z_str = strtok(NULL, " ");
-       // Check if all parameters are present
-       if (x_str != NULL && y_str != NULL && z_str != NULL) {
-         // Check if all parameters are valid numbers
-         if (isValidNumber(x_str) && isValidNumber(y_str) && isValidNumber(z_str)) {
-           // Convert string to float
-           float x = atof(x_str);
-           float y = atof(y_str);
-           float z = atof(z_str);
-           
-           if (onAbsoluteMove != nullptr) {
-             onAbsoluteMove(x, y, z);
-           } else {
-             this->reportError("ABSOLUTE_MOVE function not configured");
-           }
-         } else {
-           this->reportError("Invalid number format - Usage: ABSOLUTE_MOVE x y z (where x, y, z are numbers)");
+     case HANDLER_STOP_STREAM:
+       streamPeriod = 0;
+       break;
+     case HANDLER_STATS:
+ #if COMMAND_PARSER_STATS
+       statsLine = 0;
+       statsTag = responseTag;
+       sendStats();
+       return;  // DONE is sent by sendStats() after the last histogram
+ #else
+       reportError(F("Statistics disabled, build with COMMAND_PARSER_STATS=1"));
+       break;
+ #endif
+     case HANDLER_MOVE:
+       if (motionQueueEnabled) {
+         MotionCommand move = {};
+         move.command = id;
+         move.tag = responseTag;
+         for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+           move.values[axis] = values[axis].fixed;
          }
-       } else {
-         this->reportError("Missing parameters - Usage: ABSOLUTE_MOVE x y z");
+ #if COMMAND_PARSER_STATS
+         move.dispatched = dispatchTime;
+ #endif
+         if (moves.push(move)) {
+           return;  // DONE is sent by finishMove()
+         }
+         reportError(F("Motion queue full"));
+         break;
        }
-       Serial.println("DONE ABSOLUTE_MOVE");
-     }
-     // -----------------------------------------------------------------------------------------
-     // DELTA_MOVE
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "DELTA_MOVE") == 0) {
-       Serial.println("ACK DELTA_MOVE");
-       // Split the string using space as delimiter
-       char* dx_str = strtok(NULL, " ");
-       char* dy_str = strtok(NULL, " ");
-       char* dz_str = strtok(NULL, " ");
-       // Check if all parameters are present
-       if (dx_str != NULL && dy_str != NULL && dz_str != NULL) {
-         // Check if all parameters are valid numbers
-         if (isValidNumber(dx_str) && isValidNumber(dy_str) && isValidNumber(dz_str)) {
-           // Convert string to float
-           float dx = atof(dx_str);
-           float dy = atof(dy_str);
-           float dz = atof(dz_str);
-           
-           if (onDeltaMove != nullptr) {
-             onDeltaMove(dx, dy, dz);
-           } else {
-             this->reportError("DELTA_MOVE function not configured");
-           }
+       // Fall through - without the queue a move runs its callback like any other command
+     default:
+       if (callback.onVoid == nullptr) {
+         ResponseLine line(responseTag);
+         line.append(F("ERROR: ")).append(flashText(command.name), command.nameLength)
+             .append(F(" function not configured"));
+         sendLine(line);
+         break;
+       }
+       // Only commands without results can finish later, their DONE carries no values
+       runningCommand = command.handler == HANDLER_GET_VALUES ? CMD_UNKNOWN : id;
+       deferred = false;
+       if (count == 0) {
+         callback.onVoid();
+       } else if (useInts) {
+         if (count == 3) {
+           callback.onThreeInts(values[0].fixed, values[1].fixed, values[2].fixed);
          } else {
-           this->reportError("Invalid number format - Usage: DELTA_MOVE dx dy dz (where dx, dy, dz are numbers)");
+           callback.onInt(values[0].fixed);
          }
+       }
+ #if !COMMAND_PARSER_FIXED_POINT
+       else if (count == 3) {
+         callback.onThreeFloats(values[0].real, values[1].real, values[2].real);
        } else {
-         this->reportError("Missing parameters - Usage: DELTA_MOVE dx dy dz");
+         callback.onFloat(values[0].real);
        }
-       Serial.println("DONE DELTA_MOVE");
+ #endif
+       runningCommand = CMD_UNKNOWN;
+       if (deferred) {
+         return;
+       }
+       break;
+   }
+
+   recordDone(id);
+   if (binaryMode) {
+     sendDoneFrame(id, values, useInts);
+     return;
+   }
+
+   // Build the whole DONE line on the stack and send it with one write.
+   // The numbers are formatted in place, the static_assert above keeps them in bounds
+   ResponseLine line(responseTag);
+   line.append(F("DONE ")).append(flashText(command.name), command.nameLength);
+   if (command.handler == HANDLER_ID) {
+     line.append(F(": " DEVICE_ID), sizeof(": " DEVICE_ID) - 1);
+   } else if (command.handler == HANDLER_BAUD_RATES) {
+     line.text[line.length++] = ':';
+     for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) {
+       line.text[line.length++] = ' ';
+       line.appendUnsigned(pgm_read_dword(&BAUD_RATES[i]));
      }
-     // -----------------------------------------------------------------------------------------
-     // GET_POSITION
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "GET_POSITION") == 0) {
-       Serial.println("ACK GET_POSITION");
-       
-       if (onGetPosition != nullptr) {
-         float x = 0, y = 0, z = 0;
-         onGetPosition(x, y, z);
-         
-         Serial.print("DONE GET_POSITION: ");
-         Serial.print(x, 2); Serial.print(" ");
-         Serial.print(y, 2); Serial.print(" ");
-         Serial.println(z, 2);
-       } else {
-         this->reportError("GET_POSITION function not configured");
-         Serial.print("DONE GET_POSITION: ");
-         Serial.print("0.00 "); 
-         Serial.print("0.00 "); 
-         Serial.println("0.00");
+   } else if (command.handler == HANDLER_STOP_STREAM) {
+     line.append(F(": ")).appendUnsigned(droppedSamples);
+   } else if (command.handler == HANDLER_GET_VALUES) {
+     line.appendValues(values, command.results, command.decimals, useInts);
+   }
+   sendLine(line);
+ }
+
+ /**
+  * Helper function to send the DONE frame of a command and its returned values,
+  * [FRAME_DONE][tag][command] followed by one int32 per value in fixed point
+  * (or one per rate for GET_BAUD_RATES).
+  * Float values are rounded to FIXED_POINT_DECIMALS decimals.
+  *
+  * @param id The command
+  * @param values The values returned by the callback
+  * @param useInts true if the values are fixed point integers
+  */
+ void CommandParserBase::sendDoneFrame(CommandId id, const Value* values, bool useInts) {
+   const CommandDescriptor command = readCommand(id);
+   uint8_t frame[1 + REPLY_FRAME_SIZE + 3];
+   uint8_t length = startFrame(frame, FRAME_DONE, responseTag, id);
+   if (command.handler == HANDLER_ID) {
+     memcpy_P(frame + length, F(DEVICE_ID), sizeof(DEVICE_ID) - 1);
+     length += sizeof(DEVICE_ID) - 1;
+   } else if (command.handler == HANDLER_BAUD_RATES) {
+     for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++, length += 4) {
+       putInt32(frame + length, pgm_read_dword(&BAUD_RATES[i]));
+     }
+   } else if (command.handler == HANDLER_STOP_STREAM) {
+     putInt32(frame + length, droppedSamples);
+     length += 4;
+   } else if (command.handler == HANDLER_GET_VALUES) {
+     length += putValues(frame + length, values, command.results, useInts);
+   }
+   sendFrame(frame, length - 1);
+ }
+
+ /**
+  * Helper function to send the ACK of a command, as a line or a frame.
+  * With the motion queue it also reports the free queue depth once this
+  * command is queued, so the host knows how many more moves fit. The caller
+  * validates the command first and passes 0 for one that is rejected, a
+  * command that does not fit reports the depth it found.
+  *
+  * @param id The command
+  * @param queued Number of moves the command adds to the motion queue
+  */
+ void CommandParserBase::sendAck(CommandId id, uint8_t queued) {
+   const CommandDescriptor command = readCommand(id);
+ #if COMMAND_PARSER_STATS
+   dispatchTime = micros();
+   stats.record(id, CommandStats::STATS_RECEIVE, dispatchTime - receiveTime);
+ #endif
+   uint8_t free = moves.free();
+   if (free >= queued) {
+     free -= queued;
+   }
+   if (binaryMode) {
+     uint8_t frame[1 + REPLY_FRAME_SIZE + 3];
+     uint8_t length = startFrame(frame, FRAME_ACK, responseTag, id);
+     if (motionQueueEnabled) {
+       frame[length++] = free;
+     }
+     sendFrame(frame, length - 1);
+     return;
+   }
+   ResponseLine ack(responseTag);
+   ack.append(F("ACK ")).append(flashText(command.name), command.nameLength);
+   if (motionQueueEnabled) {
+     ack.append(F(": ")).appendUnsigned(free);
+   }
+   sendLine(ack);
+ }
+
+ /**
+  * Helper function to send a position sample if one is due.
+  * The samples keep a fixed schedule: those whose time passed while read()
+  * was not called, or that found the transmit ring full, are counted as
+  * dropped instead of being sent late.
+  */
+ void CommandParserBase::sendSample() {
+   unsigned long late = micros() - nextSample;
+   if ((long)late < 0) {
+     return;
+   }
+   if (late >= streamPeriod) {
+     unsigned long missed = late / streamPeriod;
+     droppedSamples += missed;
+     nextSample += missed * streamPeriod;
+   }
+   nextSample += streamPeriod;
+   const Callback& callback = callbacks[CMD_GET_POSITION];
+   if (callback.onVoid == nullptr || !tx.fits(binaryMode ? FRAME_OVERHEAD + 1 + MAX_ARGUMENTS * 4 : SAMPLE_LINE_SIZE)) {
+     droppedSamples++;
+     return;
+   }
+   Value* values = clearValues();
+   bool useInts = usesInts(CMD_GET_POSITION);
+   if (useInts) {
+     callback.onThreeInts(values[0].fixed, values[1].fixed, values[2].fixed);
+   }
+ #if !COMMAND_PARSER_FIXED_POINT
+   else {
+     callback.onThreeFloats(values[0].real, values[1].real, values[2].real);
+   }
+ #endif
+   if (binaryMode) {
+     uint8_t frame[1 + REPLY_FRAME_SIZE + 3];
+     uint8_t length = startFrame(frame, FRAME_SAMPLE, streamTag, CMD_STREAM_POSITION);
+     length += putValues(frame + length, values, MAX_ARGUMENTS, useInts);
+     sendFrame(frame, length - 1);
+     return;
+   }
+   uint8_t decimals = pgm_read_byte(&COMMANDS[CMD_GET_POSITION].decimals);
+   ResponseLine line(streamTag);
+   sendLine(line.append(F("POSITION")).appendValues(values, MAX_ARGUMENTS, decimals, useInts));
+ }
+
+ /**
+  * Helper function to process the received command.
+  * The command and its arguments were decoded while the line arrived, so this
+  * only validates them against the command table and runs the handler. Every
+  * line it sends echoes the tag of the command, if it had one.
+  */
+ void CommandParserBase::processCommand() {
+   if (baudPending && commandId != CMD_KEEP_BAUD) {
+     return;  // Until KEEP_BAUD arrives the bytes may be noise from a rate mismatch
+   }
+   if (tagDigits == TAG_INVALID) {
+     reportError(F("Invalid tag, use #0 to #65534 before the command"));
+     return;
+   }
+   if (commandId == CMD_UNKNOWN) {
+     ResponseLine line(responseTag);
+     line.append(F("ERROR: Unknown command - ")).append(cmdBuffer + commandToken.start, commandToken.length);
+     sendLine(line);
+     startHelp(false);
+     return;
+   }
+
+   Value* values = clearValues();
+   uint8_t failed = 0;
+   ArgumentError error = convertArguments(values, failed);
+   sendAck(commandId, error == ARGUMENTS_OK && pgm_read_byte(&COMMANDS[commandId].handler) == HANDLER_MOVE ? 1 : 0);
+   if (error == ARGUMENTS_OK) {
+     runCommand(commandId, values);
+   } else {
+     reportArguments(commandId, error, failed);
+     recordDone(commandId);
+     sendDone(commandId, responseTag);
+   }
+ }
+
+ /**
+  * Helper function to check if a command exchanges fixed point integers.
+  * Queued moves are always stored as integers, whatever callback is registered.
+  *
+  * @param id The command
+  * @return true for integer callbacks and queued moves, false for floats
+  */
+ bool CommandParserBase::usesInts(CommandId id) const {
+   return COMMAND_PARSER_FIXED_POINT || callbackIsInt[id] ||
+          (motionQueueEnabled && pgm_read_byte(&COMMANDS[id].handler) == HANDLER_MOVE);
+ }
+
+ /**
+  * Helper function to send the bare DONE line of a command.
+  *
+  * @param id The command
+  * @return true if the line was queued, false if it was dropped
+  */
+ bool CommandParserBase::sendDone(CommandId id, uint16_t tag) {
+   if (binaryMode) {
+     uint8_t frame[1 + REPLY_FRAME_SIZE + 3];
+     return sendFrame(frame, startFrame(frame, FRAME_DONE, tag, id) - 1);
+   }
+   ResponseLine line(tag);
+   line.append(F("DONE ")).append(flashText((PGM_P)pgm_read_ptr(&COMMANDS[id].name)),
+                                  pgm_read_byte(&COMMANDS[id].nameLength));
+   return sendLine(line);
+ }
+
+ /**
+  * Called from a callback to finish the command later.
+  */
+ CommandParserBase::CompletionToken CommandParserBase::defer() {
+   CompletionToken token;
+   if (runningCommand != CMD_UNKNOWN) {
+     token.command = runningCommand;
+     token.tag = responseTag;
+ #if COMMAND_PARSER_STATS
+     token.dispatched = dispatchTime;
+ #endif
+     deferred = true;
+   }
+   return token;
+ }
+
+ /**
+  * Sends the DONE of a deferred command.
+  * A full ring leaves the token pending, so the DONE is never lost.
+  */
+ bool CommandParserBase::complete(CompletionToken& token) {
+   if (!token.pending()) {
+     return true;
+   }
+   if (!tx.fits(BARE_DONE_SIZE) || !sendDone(token.command, token.tag)) {
+     return false;
+   }
+ #if COMMAND_PARSER_STATS
+   stats.record(token.command, CommandStats::STATS_RUN, micros() - token.dispatched);
+ #endif
+   token.command = CMD_UNKNOWN;
+   return true;
+ }
+
+ /**
+  * Sends the DONE of the current move and removes it from the queue.
+  * A PATH point only replies if it is the last of its batch (DONE PATH) or
+  * the batch asked for a POINT reply per point.
+  */
+ bool CommandParserBase::finishMove() {
+   const MotionCommand* move = moves.front();
+   if (move == nullptr || !tx.fits(BARE_DONE_SIZE)) {
+     return false;
+   }
+   bool sent = true;
+   if (!(move->flags & MOTION_PATH_POINT)) {
+     sent = sendDone((CommandId)move->command, move->tag);
+   } else if (move->flags & MOTION_PATH_LAST) {
+     sent = sendDone(CMD_PATH, move->tag);
+   } else if (move->flags & MOTION_REPORT) {
+     sent = sendPoint(move->tag, move->point);
+   }
+   if (!sent) {
+     return false;
+   }
+ #if COMMAND_PARSER_STATS
+   if (!(move->flags & MOTION_PATH_POINT) || (move->flags & MOTION_PATH_LAST)) {
+     uint8_t id = move->flags & MOTION_PATH_POINT ? (uint8_t)CMD_PATH : move->command;
+     stats.record(id, CommandStats::STATS_RUN, micros() - move->dispatched);
+   }
+ #endif
+   moves.pop();
+   return true;
+ }
+
+ /**
+  * Helper function to send the POINT reply of a finished PATH point,
+  * "POINT PATH: 3" or a FRAME_POINT frame.
+  *
+  * @param tag The tag of the PATH command
+  * @param point Index of the point in its batch
+  * @return true if the reply was queued, false if it was dropped
+  */
+ bool CommandParserBase::sendPoint(uint16_t tag, uint8_t point) {
+   if (binaryMode) {
+     uint8_t frame[1 + REPLY_FRAME_SIZE + 3];
+     uint8_t length = startFrame(frame, FRAME_POINT, tag, CMD_PATH);
+     frame[length++] = point;
+     return sendFrame(frame, length - 1);
+   }
+   ResponseLine line(tag);
+   return sendLine(line.append(F("POINT PATH: ")).appendUnsigned(point));
+ }
+ 
+ /**
+  * Displays a help message with all available commands and their usage.
+  * The message is sent line by line from read() as the ring drains.
+  */
+ void CommandParserBase::help() {
+   startHelp(false);
+ }
+
+ /**
+  * Helper function to start sending the help message line by line.
+  * A message already being sent is restarted.
+  *
+  * @param reply true to end the message with "DONE HELP"
+  */
+ void CommandParserBase::startHelp(bool reply) {
+   helpLine = 0;
+   helpReply = reply;
+   helpTag = reply ? responseTag : COMMAND_NO_TAG;
+   sendHelp();
+ }
+
+ /**
+  * Helper function to send the pending help lines that fit in the ring.
+  * Each line is composed first and only queued once there is room for all of
+  * it, so the message is never cut and a long help never overflows the ring.
+  */
+ void CommandParserBase::sendHelp() {
+   while (helpLine != HELP_IDLE) {
+     ResponseLine line;
+     if (helpLine == 0) {
+       line.append(F("Available commands:"));
+     } else if (helpLine <= CMD_COUNT) {
+       const CommandDescriptor command = readCommand(helpLine - 1);
+       line.append(flashText(command.usage)).append(F(" - ")).append(flashText(command.help));
+     } else if (helpReply) {
+       // A bare DONE, so in binary mode it is a DONE frame like any other
+       if (tx.fits(BARE_DONE_SIZE)) {
+         recordDone(CMD_HELP);  // No command was read since HELP, so dispatchTime is still its own
+         sendDone(CMD_HELP, helpTag);
+         helpLine = HELP_IDLE;
        }
+       return;
+     } else {
+       helpLine = HELP_IDLE;
+       return;
      }
-     // -----------------------------------------------------------------------------------------
-     // SET_SPEED
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "SET_SPEED") == 0) {
-       Serial.println("ACK SET_SPEED");
-       // Get the next token (speed value)
-       char* speed_str = strtok(NULL, " ");
-       // Check if the speed parameter is present
-       if (speed_str != NULL) {
-         // Check if the speed parameter is a valid number
-         if (isValidNumber(speed_str)) {
-           // Convert string to float
-           float speed = atof(speed_str);
-           // Speed should be positive
-           if (speed > 0) {
-             if (onSetSpeed != nullptr) {
-               onSetSpeed(speed);
-             } else {
-               this->reportError("SET_SPEED function not configured");
-             }
-           } else {
-             this->reportError("Speed must be positive - Usage: SET_SPEED speed (where speed > 0)");
-           }
-         } else {
-           this->reportError("Invalid number format - Usage: SET_SPEED speed (where speed is a number)");
-         }
-       } else {
-         this->reportError("Missing parameter - Usage: SET_SPEED speed");
+     if (!tx.fits(line.length - TAG_PREFIX_SIZE + (binaryMode ? FRAME_OVERHEAD : 2))) {
+       return;
+     }
+     sendLine(line);
+     helpLine++;
+   }
+ }
+ 
+ /**
+  * Helper function to check if the next received byte may send a response.
+  * Only the first byte of a command and the byte that ends it need room for a
+  * complete response; the bytes in between are just stored, so reading them
+  * with a busy UART loses nothing.
+  *
+  * @param c The next received byte
+  * @return true if a complete response must fit in the ring before it is read
+  */
+ bool CommandParserBase::needsRoom(int c) const {
+   if (binaryMode) {
+     return cmdIndex == 0 || c == FRAME_DELIMITER;
+   }
+   bool started = cmdIndex > 0 || lineState != LINE_SEPARATOR || lineTag != COMMAND_NO_TAG;
+   return !started || c == '\n' || c == '\r' || c == ';';
+ }
+
+ /**
+  * Helper function to check if help() or GET_STATS lines are still being sent.
+  * Their last line may be a DONE, so no new command is read until it is out.
+  *
+  * @return true while no new command should be read
+  */
+ bool CommandParserBase::sendingLines() const {
+ #if COMMAND_PARSER_STATS
+   if (statsLine != STATS_IDLE) {
+     return true;
+   }
+ #endif
+   return helpLine != HELP_IDLE;
+ }
+
+ /**
+  * Helper function to count the time from the ACK to the DONE of a command
+  * that replies without waiting. Queued moves, deferred commands and PATH
+  * batches are counted where their DONE is sent instead.
+  *
+  * @param id The command
+  */
+ void CommandParserBase::recordDone(CommandId id) {
+ #if COMMAND_PARSER_STATS
+   stats.record(id, CommandStats::STATS_RUN, micros() - dispatchTime);
+ #else
+   (void)id;
+ #endif
+ }
+
+ #if COMMAND_PARSER_STATS
+ /**
+  * Helper function to send the histograms that fit in the ring.
+  * Empty histograms are skipped and the others are sent from their first to
+  * their last non empty bucket, "STATS ABSOLUTE_MOVE RUN 13: 2 5 0 1" meaning
+  * 2 moves took 8192 to 16383 us, 5 twice that and so on. Like help(), each
+  * line is only queued once it fits whole, and the lines go out over the
+  * following calls to read().
+  */
+ void CommandParserBase::sendStats() {
+   while (statsLine != STATS_IDLE) {
+     if (statsLine == STATS_COMMANDS * CommandStats::STATS_PHASES) {
+       // Nothing was read since GET_STATS, so dispatchTime is still its own
+       if (tx.fits(BARE_DONE_SIZE)) {
+         recordDone(CMD_GET_STATS);
+         sendDone(CMD_GET_STATS, statsTag);
+         statsLine = STATS_IDLE;
        }
-       Serial.println("DONE SET_SPEED");
+       return;
      }
-     // -----------------------------------------------------------------------------------------
-     // GET_SPEED
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "GET_SPEED") == 0) {
-       Serial.println("ACK GET_SPEED");
-       
-       if (onGetSpeed != nullptr) {
-          float speed = 0;
-         onGetSpeed(speed);
-         Serial.print("DONE GET_SPEED: ");
-         Serial.println(speed, 0);
-       } else {
-         this->reportError("GET_SPEED function not configured");
-         Serial.print("DONE GET_SPEED: ");
-         Serial.println("0");
+     uint8_t id = statsLine / CommandStats::STATS_PHASES;
+     CommandStats::Phase phase = (CommandStats::Phase)(statsLine % CommandStats::STATS_PHASES);
+     const uint16_t* counts = stats.histogram(id, phase);
+     uint8_t first = 0, last = STATS_BUCKETS;
+     while (first < last && counts[first] == 0) {
+       first++;
+     }
+     while (last > first && counts[last - 1] == 0) {
+       last--;
+     }
+     if (first < last) {
+       ResponseLine line(statsTag);
+       line.append(F("STATS ")).append(flashText((PGM_P)pgm_read_ptr(&COMMANDS[id].name)),
+                                       pgm_read_byte(&COMMANDS[id].nameLength))
+           .append(phase == CommandStats::STATS_RECEIVE ? F(" RECEIVE ") : F(" RUN "))
+           .appendUnsigned(first).append(F(":"));
+       for (uint8_t i = first; i < last; i++) {
+         line.append(F(" ")).appendUnsigned(counts[i]);
        }
+       if (!tx.fits(line.length - TAG_PREFIX_SIZE + (binaryMode ? FRAME_OVERHEAD : 2 + TAG_PREFIX_SIZE))) {
+         return;
+       }
+       sendLine(line);
      }
-     // -----------------------------------------------------------------------------------------
-     // GET_MIN_SPEED
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "GET_MIN_SPEED") == 0) {
-       Serial.println("ACK GET_MIN_SPEED");
-       
-       if (onGetMinSpeed != nullptr) {
-         float minSpeed = 0;
-         onGetMinSpeed();
-         Serial.print("DONE GET_MIN_SPEED: ");
-         Serial.println(minSpeed, 0);
+     statsLine++;
+   }
+ }
+ #endif
+
+ /**
+  * Helper function to advance the line reader with one received byte.
+  * Each byte is classified once and the line is normalized as it arrives:
+  * leading and trailing whitespace is never counted, each run of separators
+  * counts as a single space and only the command token is case folded and
+  * stored in cmdBuffer. Argument bytes go straight into their number token
+  * and are only counted, so the length limit is still the one of the
+  * normalized line. The line is dispatched as soon as its terminator arrives.
+  * A ';' ends a command like a newline, so several commands on one line run
+  * in order in the same read().
+  *
+  * @param c The received byte
+  */
+ void CommandParserBase::consume(char c) {
+   // Check if we've reached the end of a command (newline, carriage return or ';')
+   if (c == '\n' || c == '\r' || c == ';') {
+     if (lineState == LINE_DISCARD) {
+       resetLine();
+       return;
+     }
+     endToken();
+     if (cmdIndex > 0) {  // Only process if we have content (ignore empty lines)
+       responseTag = tagDigits == TAG_INVALID ? COMMAND_NO_TAG : lineTag;
+       processCommand();
+       responseTag = COMMAND_NO_TAG;
+     }
+     resetLine();
+     return;
+   }
+   if (lineState == LINE_DISCARD) {
+     return;
+   }
+
+   // Whitespace separates tokens and is not stored
+   if (isspace(c)) {
+     endToken();
+     return;
+   }
+
+   // Optional "#17" tag before the command, kept as a number instead of being stored
+   if (lineState == LINE_SEPARATOR && cmdIndex == 0 && c == '#' && lineTag == COMMAND_NO_TAG) {
+ #if COMMAND_PARSER_STATS
+     receiveTime = micros();
+ #endif
+     lineState = LINE_TAG;
+     lineTag = 0;
+     return;
+   }
+   if (lineState == LINE_TAG) {
+     if (tagDigits != TAG_INVALID) {
+       uint32_t tag = (uint32_t)lineTag * 10 + (c - '0');
+       if (c < '0' || c > '9' || tag >= COMMAND_NO_TAG || tagDigits == 5) {
+         tagDigits = TAG_INVALID;
        } else {
-         this->reportError("GET_MIN_SPEED function not configured");
-         Serial.print("DONE GET_MIN_SPEED: ");
-         Serial.println("0");
+         lineTag = tag;
+         tagDigits++;
        }
      }
-     // -----------------------------------------------------------------------------------------
-     // GET_MAX_SPEED
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "GET_MAX_SPEED") == 0) {
-       Serial.println("ACK GET_MAX_SPEED");
-       
-       if (onGetMaxSpeed != nullptr) {
-         float maxSpeed = 0;
-         onGetMaxSpeed();
-         Serial.print("DONE GET_MAX_SPEED: ");
-         Serial.println(maxSpeed, 0);
-       } else {
-         this->reportError("GET_MAX_SPEED function not configured");
-         Serial.print("DONE GET_MAX_SPEED: ");
-         Serial.println("0");
+     return;
+   }
+
+   // A new token after a separator also needs room for the single space before it
+   int needed = (lineState == LINE_SEPARATOR && cmdIndex > 0) ? 2 : 1;
+   // Handle buffer overflow (command too long)
+   if (cmdIndex + needed > bufferSize - 1) {
+     responseTag = tagDigits == TAG_INVALID ? COMMAND_NO_TAG : lineTag;
+     this->reportError(F("Command too long"));
+     responseTag = COMMAND_NO_TAG;
+     // Ignore the rest of the command to avoid treating the remainder as a new one
+     resetLine();
+     lineState = LINE_DISCARD;
+     return;
+   }
+
+   // First byte of a token
+   if (lineState == LINE_SEPARATOR) {
+     if (cmdIndex == 0) {
+ #if COMMAND_PARSER_STATS
+       if (lineTag == COMMAND_NO_TAG) {
+         receiveTime = micros();  // A tagged line started at its '#'
        }
+ #endif
+       lineState = LINE_COMMAND;
+       commandToken.start = 0;
+     } else {
+       cmdIndex++;  // The run of separators counts as one space
+       lineState = LINE_ARGUMENT;
+       if (argumentCount < MAX_ARGUMENTS) {
+         arguments[argumentCount].number.reset();
+       }
+       argumentCount++;
      }
-     // -----------------------------------------------------------------------------------------
-     // GET_ID
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "GET_ID") == 0) {
-       Serial.println("ACK GET_ID");
-       Serial.print("DONE GET_ID: ");
-       Serial.println(DEVICE_ID);
+   }
+   if (lineState == LINE_COMMAND) {
+     // Convert to uppercase
+     if (c >= 'a' && c <= 'z') {
+       c -= 'a' - 'A';
      }
-     // -----------------------------------------------------------------------------------------
-     // CHECK_ERRORS
-     // -----------------------------------------------------------------------------------------
-     else if (strcmp(token, "CHECK_ERRORS") == 0) {
-       Serial.println("ACK CHECK_ERRORS");
-       
-       if (onCheckErrors != nullptr) {
-         onCheckErrors();
-       } else {
-        this->reportError("CHECK_ERRORS function not configured");
-       }
-       
-       Serial.println("DONE CHECK_ERRORS");
+     cmdBuffer[cmdIndex] = c;
+   } else if (commandId != CMD_UNKNOWN && argumentCount <= pgm_read_byte(&COMMANDS[commandId].arity)) {
+     arguments[argumentCount - 1].number.feed(c);
+   }
+   cmdIndex++;
+ }
+
+ /**
+  * Helper function to process a received frame in binary mode.
+  * The frame is decoded in place in cmdBuffer and checked, then its arguments
+  * go through the same checks and handlers as a text line, so both modes run
+  * exactly the same commands. A frame that fails its CRC is answered with an
+  * error frame only, since its tag can not be trusted.
+  */
+ void CommandParserBase::processFrame() {
+   uint8_t* frame = (uint8_t*)cmdBuffer;
+   int length = FrameCodec::decode(frame, cmdIndex);
+   bool valid = length >= 5 && FrameCodec::crc16(frame, length - 2) == (frame[length - 2] | frame[length - 1] << 8);
+   if (baudPending && (!valid || frame[0] != CMD_KEEP_BAUD)) {
+     return;  // Until KEEP_BAUD arrives the bytes may be noise from a rate mismatch
+   }
+   if (!valid) {
+     reportError(F("Invalid frame"));
+     return;
+   }
+   length -= 5;  // Opcode, tag and CRC, the rest are the arguments
+   responseTag = frame[1] | frame[2] << 8;
+   if (frame[0] >= CMD_COUNT) {
+     reportError(F("Unknown opcode"));
+     responseTag = COMMAND_NO_TAG;
+     return;
+   }
+   CommandId id = (CommandId)frame[0];
+   const CommandDescriptor command = readCommand(id);
+   if (command.handler == HANDLER_PATH) {
+     queuePath(frame + 3, length);
+     responseTag = COMMAND_NO_TAG;
+     return;
+   }
+   Value* values = clearValues();
+   ArgumentError error = length == command.arity * 4 ? ARGUMENTS_OK : ARGUMENTS_LENGTH;
+   for (uint8_t i = 0; error == ARGUMENTS_OK && i < command.arity; i++) {
+     values[i].fixed = getInt32(frame + 3 + i * 4);
+     if (command.argumentType == ARG_POSITIVE_NUMBER && values[i].fixed <= 0) {
+       error = ARGUMENTS_NOT_POSITIVE;
      }
-     // -----------------------------------------------------------------------------------------
-     // Unknown command
-     // -----------------------------------------------------------------------------------------
-     else {
-       this->reportError("Unknown command - ");
-       Serial.println(cmdBuffer);
-       help();
+ #if !COMMAND_PARSER_FIXED_POINT
+     if (!usesInts(id)) {
+       values[i].real = (float)values[i].fixed / fixedScale(FIXED_POINT_DECIMALS);
      }
+ #endif
+   }
+   sendAck(id, error == ARGUMENTS_OK && command.handler == HANDLER_MOVE ? 1 : 0);
+   if (error == ARGUMENTS_OK) {
+     runCommand(id, values);
+   } else {
+     reportArguments(id, error, 0);
+     recordDone(id);
+     sendDone(id, responseTag);
    }
+   responseTag = COMMAND_NO_TAG;
  }
- 
+
  /**
-  * Displays a help message with all available commands and their usage.
-  * This function prints all supported commands to the serial port.
-  */
- void CommandParser::help() {
-   Serial.println("Available commands:");
-   Serial.println("HELP - Displays this help message");
-   Serial.println("SET_HOME - Sets current position as home (0,0,0)");
-   Serial.println("GO_HOME - Moves to home position (0,0,0)");
-   Serial.println("ABSOLUTE_MOVE x y z - Moves to absolute position x, y, z");
-   Serial.println("DELTA_MOVE dx dy dz - Moves relative to current position by dx, dy, dz");
-   Serial.println("GET_POSITION - Returns current position");
-   Serial.println("SET_SPEED speed - Sets movement speed to speed in mm/s");
-   Serial.println("GET_SPEED - Returns current movement speed in mm/s");
-   Serial.println("GET_MIN_SPEED - Returns minimum allowed movement speed in mm/s");
-   Serial.println("GET_MAX_SPEED - Returns maximum allowed movement speed in mm/s");
-   Serial.println("GET_ID - Returns the unique device identifier");
-   Serial.println("CHECK_ERRORS - Performs system diagnostics and reports any errors");
+  * Helper function to queue the points of a PATH frame, [flags][x y z]...,
+  * as absolute moves. The batch gets one ACK and, once its last point is
+  * finished, one DONE. It is queued whole or rejected whole, so the host
+  * never has to work out which points were taken.
+  *
+  * @param payload The flags byte followed by the points
+  * @param length Number of bytes in the payload
+  */
+ void CommandParserBase::queuePath(const uint8_t* payload, uint8_t length) {
+   const uint8_t pointSize = MOTION_AXES * 4;
+   uint8_t points = length > 0 ? (length - 1) / pointSize : 0;
+   bool valid = length > 0 && (length - 1) % pointSize == 0 && points >= 1 && points <= PATH_MAX_POINTS;
+   // The ACK reports the depth left once the batch is queued, or the depth
+   // found if it is rejected
+   bool accepted = valid && motionQueueEnabled && moves.free() >= points;
+   sendAck(CMD_PATH, accepted ? points : 0);
+   if (!valid) {
+     reportError(F("Invalid payload length"));
+   } else if (!motionQueueEnabled) {
+     reportError(F("PATH needs the motion queue"));
+   } else if (moves.free() < points) {
+     reportError(F("Motion queue full"));
+   } else {
+     MotionCommand move = {};
+     move.command = CMD_ABSOLUTE_MOVE;
+     move.tag = responseTag;
+ #if COMMAND_PARSER_STATS
+     move.dispatched = dispatchTime;
+ #endif
+     for (uint8_t i = 0; i < points; i++) {
+       const uint8_t* point = payload + 1 + i * pointSize;
+       for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+         move.values[axis] = getInt32(point + axis * 4);
+       }
+       move.flags = MOTION_PATH_POINT | (i == points - 1 ? MOTION_PATH_LAST : 0) |
+                    (payload[0] & PATH_REPORT_POINTS ? MOTION_REPORT : 0);
+       move.point = i;
+       moves.push(move);
+     }
+     return;  // DONE is sent by finishMove() with the last point
+   }
+   recordDone(CMD_PATH);
+   sendDone(CMD_PATH, responseTag);
  }
- 
+
+ /**
+  * Helper function to collect the bytes of a frame in binary mode.
+  * Bytes are stored until the delimiter, a frame longer than cmdBuffer is
+  * skipped up to the next delimiter, as a text line that is too long.
+  *
+  * @param c The received byte
+  */
+ void CommandParserBase::consumeFrame(uint8_t c) {
+   if (c == FRAME_DELIMITER) {
+     if (lineState == LINE_DISCARD) {
+       reportError(F("Frame too long"));
+     } else if (cmdIndex > 0) {  // Ignore empty frames, e.g. a delimiter sent to resynchronize
+       processFrame();
+     }
+     resetLine();
+     return;
+   }
+   if (cmdIndex == bufferSize) {
+     lineState = LINE_DISCARD;
+   }
+   if (lineState != LINE_DISCARD) {
+ #if COMMAND_PARSER_STATS
+     if (cmdIndex == 0) {
+       receiveTime = micros();
+     }
+ #endif
+     cmdBuffer[cmdIndex++] = c;
+   }
+ }
+
  /**
   * Reads and processes incoming serial commands.
   * This function should be called repeatedly in the main loop.
   * It handles command termination, buffer overflow, and parses complete commands.
+  * Output is only drained as far as Serial.availableForWrite() allows. No byte
+  * is read while a help message is pending, and no command is started or
+  * ended while the ring has no room for a complete response, so the host is
+  * slowed down instead of losing replies.
+  * After the BINARY command the bytes are read as frames instead of lines.
+  * On cores where availableForWrite() always returns 0 nothing is drained;
+  * there setOverflowPolicy(TxBuffer::OVERFLOW_BLOCK) restores blocking output.
   */
- void CommandParser::read() {
-   // Process all available bytes in the serial buffer
-   while (Serial.available() > 0) {
-     // Read a single character from the serial buffer
-     char c = Serial.read();
-     
-     // Check if we've reached the end of a command (newline or carriage return)
-     if (c == '\n' || c == '\r') {
-       if (cmdIndex > 0) {  // Only process if we have content (ignore empty lines)
-         cmdBuffer[cmdIndex] = '\0';  // Null-terminate the string
-         trim(cmdBuffer);   // Trim leading and trailing whitespace
-         convertToUppercase(cmdBuffer);  // Convert to uppercase
-         processCommand();  // Process the complete command
-         cmdIndex = 0;      // Reset the buffer index for the next command
+ void CommandParserBase::read() {
+   if (baudPending && (long)(millis() - baudDeadline) >= 0) {
+     // KEEP_BAUD never arrived, so the host is not talking at the new rate
+     baudPending = false;
+     switchBaud(previousBaud);
+     resetLine();
+     reportError(F("Baud rate not kept, back to the previous rate"));
+   }
+   tx.drain();
+   if (streamPeriod != 0) {
+     sendSample();
+   }
+   sendHelp();
+ #if COMMAND_PARSER_STATS
+   sendStats();
+ #endif
+   // Process the available bytes in the serial buffer while responses fit.
+   // The room is checked once per command, at its first and last byte, and the
+   // ring is drained again before giving up, so the replies of the first
+   // commands of a ';' line do not stop the next ones while the UART keeps up
+   while (!sendingLines() && Serial.available() > 0) {
+     if (needsRoom(Serial.peek()) && !tx.fits(TX_RESPONSE_SIZE)) {
+       tx.drain();
+       if (!tx.fits(TX_RESPONSE_SIZE)) {
+         break;
        }
-     } 
-     // If there's still room in the buffer, store the character
-     else if (cmdIndex < BUFFER_SIZE - 1) {
-       cmdBuffer[cmdIndex++] = c;  // Store the character and increment the index
      }
-     // Handle buffer overflow (command too long)
-     else {
-       cmdIndex = 0;  // Reset the buffer index
-       this->reportError("Command too long");
-       
-       // Consume the rest of the command until end of line to avoid
-       // treating the remainder as a new command
-       while (Serial.available() > 0) {
-         char discard = Serial.read();
-         if (discard == '\n' || discard == '\r') break;
-       }
+     if (binaryMode) {
+       consumeFrame(Serial.read());
+     } else {
+       consume(Serial.read());
      }
    }
- }
\ No newline at end of file
+   sendHelp();
+ #if COMMAND_PARSER_STATS
+   sendStats();
+ #endif
+   tx.drain();
+ }
@@ -14,76 +14,527 @@
  #include <Arduino.h>
  #include <ctype.h>
  #include <string.h>
+ #include "CommandList.h"
+ #include "CommandStats.h"
+ #include "FrameCodec.h"
+ #include "MotionQueue.h"
+ #include "NumberParser.h"
+ #include "TxBuffer.h"
  
- #define BUFFER_SIZE 64      // Maximum command length
  #define SERIAL_TIMEOUT 50   // Serial read timeout in milliseconds
  #define SERIAL_BAUD 115200  // Default serial baud rate
+ #define BAUD_CONFIRM_TIMEOUT 1000  // Milliseconds to receive KEEP_BAUD after SET_BAUD
+ #define STREAM_MAX_RATE 1000  // Highest STREAM_POSITION rate in Hz
  #define DEVICE_ID "CX25F7TK9P"  // Fixed unique device identifier (10 characters)
+ #define MAX_ARGUMENTS 3     // Maximum number of values exchanged with a callback (default arguments per command)
+ #define FIXED_POINT_DECIMALS 3  // Integer values are thousandths of the unit (micrometres for mm)
+ #define TX_RESPONSE_SIZE 224  // Free TX space needed to read the next line (ACK + ERROR + DONE)
+ #if COMMAND_PARSER_STATS
+ #define RESPONSE_LINE_SIZE 192  // Longest response line with its "\r\n", longer lines are cut (a GET_STATS line)
+ #else
+ #define RESPONSE_LINE_SIZE 128  // Longest response line with its "\r\n", longer lines are cut
+ #endif
+ #define COMMAND_NO_TAG 0xFFFF   // Tag of an untagged command, tags go from 0 to 65534
+ #define TAG_PREFIX_SIZE 7       // Longest tag prefix, "#65534 "
+
+ // Kinds of the frames sent in binary mode, requests carry a CommandId instead
+ #define FRAME_ACK 0x80   // [command][free queue depth, only with the motion queue]
+ #define FRAME_DONE 0x81  // [command][returned values as int32, or the DEVICE_ID text]
+ #define FRAME_TEXT 0x82  // A text line without "\r\n", used for errors and help
+ #define FRAME_POINT 0x83 // [CMD_PATH][index] of a finished PATH point, when requested
+ #define FRAME_SAMPLE 0x84 // [CMD_STREAM_POSITION][x y z as int32] sent by the position stream
+
+ // Points accepted in one PATH frame, a batch must also fit in the motion queue
+ #ifndef PATH_MAX_POINTS
+ #define PATH_MAX_POINTS (MOTION_QUEUE_DEPTH < 16 ? MOTION_QUEUE_DEPTH : 16)
+ #endif
+ #define PATH_REPORT_POINTS 0x01  // PATH flag: send a POINT reply as each point finishes
+
+ // Longest encoded request, a PATH frame: COBS code + command + tag + flags + points + CRC
+ #define FRAME_BUFFER_SIZE (1 + 3 + 1 + PATH_MAX_POINTS * MOTION_AXES * 4 + 2)
+
+ // Rates accepted by SET_BAUD, with at most 7 digits each. The AVR list keeps
+ // the rates a 16 MHz clock divides with a small error
+ #ifndef SERIAL_BAUD_RATES
+ #if defined(__AVR__)
+ #define SERIAL_BAUD_RATES 9600, 19200, 38400, 57600, 115200, 250000, 500000, 1000000, 2000000
+ #else
+ #define SERIAL_BAUD_RATES 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600, 1000000, 2000000
+ #endif
+ #endif
+
+ // Set to 1 (e.g. with a build flag) to exchange only integer values with the
+ // callbacks, so no float code is linked for parsing or replies
+ #ifndef COMMAND_PARSER_FIXED_POINT
+ #define COMMAND_PARSER_FIXED_POINT 0
+ #endif
+
+ static_assert(TX_BUFFER_SIZE >= TX_RESPONSE_SIZE, "TX_BUFFER_SIZE must hold a complete response");
+ static_assert(RESPONSE_LINE_SIZE <= 255, "RESPONSE_LINE_SIZE must fit in a uint8_t length");
+ static_assert(MOTION_AXES == MAX_ARGUMENTS, "A queued move carries MAX_ARGUMENTS values");
+ static_assert(FIXED_POINT_DECIMALS <= 3, "A stream period of 1 s in fixed point Hz must fit in 32 bits");
+ static_assert(PATH_MAX_POINTS >= 1 && PATH_MAX_POINTS <= MOTION_QUEUE_DEPTH && FRAME_BUFFER_SIZE - 2 <= FRAME_MAX_DATA,
+               "PATH_MAX_POINTS must fit in the motion queue and in one frame");
+
+ #define COMMAND_ARITY(name, handler, arity, ...) arity,
+ // Arguments taken by each command, in CommandId order
+ static constexpr uint8_t COMMAND_ARITIES[] = { COMMAND_LIST(COMMAND_ARITY) };
+ #undef COMMAND_ARITY
+
+ /**
+  * Finds the most arguments taken by a command, used to check the size of a parser.
+  *
+  * @param index First command to check
+  * @param most Most arguments found before index
+  * @return The most arguments taken by any command
+  */
+ static constexpr uint8_t mostCommandArguments(uint8_t index = 0, uint8_t most = 0) {
+   return index == sizeof(COMMAND_ARITIES) ? most :
+          mostCommandArguments(index + 1, COMMAND_ARITIES[index] > most ? COMMAND_ARITIES[index] : most);
+ }
  
  /**
-  * CommandParser class - Handles serial command processing
+  * CommandParserBase class - Handles serial command processing
   * 
   * This class provides methods for receiving, validating, and executing
-  * commands received over serial communication.
+  * commands received over serial communication. Its buffers are given by
+  * BasicCommandParser, so parsers of any size share this code.
   */
- class CommandParser {
+ class CommandParserBase {
    public:
      // Function pointer types for callbacks
      typedef void (*VoidCallback)();
      typedef void (*ThreeFloatsCallback)(float &a, float &b, float &c);
      typedef void (*FloatCallback)(float &value);
+     typedef void (*ThreeIntsCallback)(int32_t &a, int32_t &b, int32_t &c);
+     typedef void (*IntCallback)(int32_t &value);
+
+ #define COMMAND_ID(name, ...) CMD_##name,
+     // Command identifiers, CMD_<name> for every row of COMMAND_LIST (CMD_HELP,
+     // CMD_ABSOLUTE_MOVE...), resolved from the command token by lookupCommand()
+     enum CommandId : uint8_t {
+       COMMAND_LIST(COMMAND_ID)
+       CMD_COUNT,              // Number of known commands
+       CMD_UNKNOWN = CMD_COUNT // Returned when the token is not a command
+     };
+ #undef COMMAND_ID
+
+     // Command whose DONE is sent later with complete(), obtained with defer()
+     struct CompletionToken {
+       CommandId command = CMD_UNKNOWN;  // CMD_UNKNOWN once completed (or if not deferred)
+       uint16_t tag = COMMAND_NO_TAG;    // Tag echoed with DONE
+ #if COMMAND_PARSER_STATS
+       unsigned long dispatched = 0;     // micros() of the ACK, timed again at the DONE
+ #endif
+
+       /**
+        * Checks if the token still has a DONE to send.
+        *
+        * @return true until complete() succeeds
+        */
+       bool pending() const { return command != CMD_UNKNOWN; }
+     };
  
      
+   protected:
+     // Token stored in cmdBuffer, referenced by position instead of being copied
+     struct TokenView {
+       uint8_t start;      // Index of the first character in cmdBuffer
+       uint8_t length;     // Number of characters
+     };
+
+     // Numeric argument, parsed byte by byte as it arrives instead of being stored
+     struct ArgumentToken {
+       NumberParser number;  // Parser fed with the argument characters
+     };
+
+     // Value exchanged with a callback, in the representation it uses
+     union Value {
+       float real;
+       int32_t fixed;  // Fixed point, FIXED_POINT_DECIMALS decimals
+     };
+
+     /**
+      * Sets the buffers owned by the derived BasicCommandParser.
+      *
+      * @param buffer The receive buffer
+      * @param size Bytes in the receive buffer
+      * @param argumentTokens The argument tokens, MAX_ARGUMENTS of them
+      * @param valueSlots The values exchanged with a callback, one per argument token
+      */
+     CommandParserBase(char* buffer, uint8_t size, ArgumentToken* argumentTokens, Value* valueSlots)
+       : cmdBuffer(buffer), bufferSize(size), arguments(argumentTokens), callbackValues(valueSlots) {}
+
    private:
+
+     // Line reader state, updated for every received byte
+     enum LineState : uint8_t {
+       LINE_SEPARATOR,     // Between tokens (or before the first one)
+       LINE_TAG,           // Inside the "#17" tag before the command
+       LINE_COMMAND,       // Inside the command token
+       LINE_ARGUMENT,      // Inside an argument token
+       LINE_DISCARD        // Skipping the rest of a line that was too long
+     };
+
+     // Result of checking the arguments of a command, reported after its ACK
+     enum ArgumentError : uint8_t {
+       ARGUMENTS_OK,
+       ARGUMENTS_MISSING,       // Fewer arguments than the command takes
+       ARGUMENTS_INVALID,       // An argument is not a number, or is out of range
+       ARGUMENTS_NOT_POSITIVE,  // An argument of a positive only command is <= 0
+       ARGUMENTS_LENGTH         // The payload of a frame does not match the arity
+     };
+
      // General variables
-     char cmdBuffer[BUFFER_SIZE];  // Buffer to store incoming command
-     int cmdIndex = 0;             // Index to keep track of buffer position
-     
-     // Callback function pointers
-     VoidCallback onSetHome = nullptr;
-     VoidCallback onGoHome = nullptr;
-     ThreeFloatsCallback onAbsoluteMove = nullptr;
-     ThreeFloatsCallback onDeltaMove = nullptr;
-     ThreeFloatsCallback onGetPosition = nullptr;
-     FloatCallback onSetSpeed = nullptr;
-     FloatCallback onGetSpeed = nullptr;
-     FloatCallback onGetMinSpeed = nullptr;
-     FloatCallback onGetMaxSpeed = nullptr;
-     VoidCallback onCheckErrors = nullptr;
-     
-     // Error reporter function
-     void reportError(const char* errorMessage) {
-       Serial.print("ERROR: ");
-       Serial.println(errorMessage);
-     }
+     // Command token of the line (in uppercase), or the encoded frame in binary mode
+     char* const cmdBuffer;
+     const uint8_t bufferSize;
+     int cmdIndex = 0;             // Length of the normalized line, or bytes of the frame
+     uint8_t lineState = LINE_SEPARATOR;
+     uint16_t lineTag = COMMAND_NO_TAG;  // Tag of the line being read
+     uint8_t tagDigits = 0;        // Digits in the tag, TAG_INVALID if it is not a valid tag
+     uint16_t responseTag = COMMAND_NO_TAG;  // Tag echoed by the lines being sent
+     uint32_t baudRate = SERIAL_BAUD;         // Current serial baud rate
+     uint32_t previousBaud = SERIAL_BAUD;     // Rate restored if KEEP_BAUD does not arrive
+     unsigned long baudDeadline = 0;          // millis() at which the new rate falls back
+     bool baudPending = false;                // SET_BAUD is waiting for KEEP_BAUD
+
+     // Position stream started by STREAM_POSITION, sent from read()
+     unsigned long streamPeriod = 0;          // Microseconds between samples, 0 when stopped
+     unsigned long nextSample = 0;            // micros() at which the next sample is due
+     uint16_t streamTag = COMMAND_NO_TAG;     // Tag of STREAM_POSITION, echoed by the samples
+     uint32_t droppedSamples = 0;             // Samples not sent since the stream started
+     bool binaryMode = false;      // Commands and responses are COBS frames instead of text lines
+     TokenView commandToken = {};  // Command token in cmdBuffer
+     CommandId commandId = CMD_UNKNOWN;  // Command resolved from the first token
+     uint8_t argumentCount = 0;    // Number of arguments started on the current line
+     ArgumentToken* const arguments;  // MAX_ARGUMENTS are stored, later ones are counted but not kept
+     Value* const callbackValues;  // Arguments and results of the command being run
      
+     // Callback registered for each command, its type is given by the command table
+     // and by callbackIsInt
+     union Callback {
+       VoidCallback onVoid;
+       ThreeFloatsCallback onThreeFloats;
+       FloatCallback onFloat;
+       ThreeIntsCallback onThreeInts;
+       IntCallback onInt;
+     };
+     Callback callbacks[CMD_COUNT] = {};
+     bool callbackIsInt[CMD_COUNT] = {};  // The callback takes fixed point integers
+     CommandId runningCommand = CMD_UNKNOWN;  // Command whose callback can call defer()
+     bool deferred = false;                   // The running callback called defer()
+
+     // Moves waiting for the executor, used instead of the move callbacks
+     // once useMotionQueue() is called
+     MotionQueue moves;
+     bool motionQueueEnabled = false;
+
+     static const uint8_t HELP_IDLE = 0xFF;  // helpLine value when no help() is being sent
+     static const uint8_t TAG_INVALID = 0xFF;  // tagDigits value for a malformed tag
+
+     // Output, written to the ring and drained to Serial from read()
+     TxBuffer tx;
+     uint8_t helpLine = HELP_IDLE;  // Next help() line to send (0 is the header)
+     bool helpReply = false;        // Send "DONE HELP" after the last help() line
+     uint16_t helpTag = COMMAND_NO_TAG;  // Tag echoed with "DONE HELP"
+
+ #if COMMAND_PARSER_STATS
+     static const uint8_t STATS_IDLE = 0xFF;  // statsLine value when no GET_STATS is being sent
+
+     // Latency histograms, and the times they are measured from
+     CommandStats stats;
+     unsigned long receiveTime = 0;   // micros() of the first byte of the line or frame being read
+     unsigned long dispatchTime = 0;  // micros() of the last ACK
+     uint8_t statsLine = STATS_IDLE;  // Next histogram to send, command * STATS_PHASES + phase
+     uint16_t statsTag = COMMAND_NO_TAG;  // Tag of GET_STATS, echoed by its lines
+ #endif
+
+     // Response line composed on the stack, then queued with a single write.
+     // The text starts after TAG_PREFIX_SIZE free bytes, where sendLine() puts
+     // the "#17 " prefix or the frame header, and 3 bytes are kept at the end
+     // for "\r\n" or the CRC and the frame delimiter
+     struct ResponseLine {
+       char text[RESPONSE_LINE_SIZE];
+       uint8_t length = TAG_PREFIX_SIZE;
+       uint16_t tag;
+
+       /**
+        * Starts a line for a command.
+        *
+        * @param tag The tag to echo, COMMAND_NO_TAG for none
+        */
+       explicit ResponseLine(uint16_t tag = COMMAND_NO_TAG) : tag(tag) {}
+
+       /**
+        * Appends bytes, cutting them if the line is full.
+        * Room for the line ending is always kept.
+        *
+        * @param bytes The bytes
+        * @param count Number of bytes
+        * @return The line, so appends can be chained
+        */
+       ResponseLine& append(const char* bytes, size_t count);
+
+       /**
+        * Appends a null-terminated string.
+        *
+        * @param str The string
+        * @return The line, so appends can be chained
+        */
+       ResponseLine& append(const char* str) { return append(str, strlen(str)); }
+
+       /**
+        * Appends bytes stored in flash, cutting them if the line is full.
+        *
+        * @param bytes The bytes, e.g. from F() or PROGMEM
+        * @param count Number of bytes
+        * @return The line, so appends can be chained
+        */
+       ResponseLine& append(const __FlashStringHelper* bytes, size_t count);
+
+       /**
+        * Appends a null-terminated string stored in flash.
+        *
+        * @param str The string, e.g. F("text")
+        * @return The line, so appends can be chained
+        */
+       ResponseLine& append(const __FlashStringHelper* str) {
+         return append(str, strlen_P(reinterpret_cast<const char*>(str)));
+       }
+
+       /**
+        * Appends an unsigned integer as decimal text.
+        *
+        * @param value The value
+        * @return The line, so appends can be chained
+        */
+       ResponseLine& appendUnsigned(uint32_t value);
+
+       /**
+        * Appends ":" and the values returned by a callback, each after a space.
+        * Does not check the room left, the line must start short enough.
+        *
+        * @param values The values
+        * @param count Number of values
+        * @param decimals Decimals printed for each value
+        * @param useInts true if the values are fixed point integers
+        * @return The line, so appends can be chained
+        */
+       ResponseLine& appendValues(const Value* values, uint8_t count, uint8_t decimals, bool useInts);
+     };
+
      /**
-      * Helper function to trim leading and trailing whitespace
-      * 
-      * @param str Pointer to the string to be trimmed
+      * Helper function to store the values returned by a callback in a frame,
+      * as int32 in fixed point. Float values are rounded and saturated to int32.
+      *
+      * @param bytes Where the values are written, 4 bytes each
+      * @param values The values
+      * @param count Number of values
+      * @param useInts true if the values are fixed point integers
+      * @return Number of bytes written
       */
-     void trim(char* str);
-     
+     static uint8_t putValues(uint8_t* bytes, const Value* values, uint8_t count, bool useInts);
+
      /**
-      * Helper function to convert a string to uppercase
-      * 
-      * @param str Pointer to the string to be converted
+      * Helper function to send a position sample if one is due.
       */
-     void convertToUppercase(char* str);
-     
+     void sendSample();
+
      /**
-      * Helper function to check if a string is a valid number
-      * 
-      * @param str The string to be validated
-      * @return true if the string represents a valid number, false otherwise
+      * Helper function to terminate a line and queue it with one write.
+      * In binary mode the line is sent as a FRAME_TEXT frame.
+      *
+      * @param line The line, without "\r\n"
+      * @return true if the line was queued, false if it was dropped
+      */
+     bool sendLine(ResponseLine& line);
+
+     /**
+      * Helper function to add the CRC to a frame, encode it and queue it with
+      * one write.
+      *
+      * @param frame The frame, its contents start at frame[1] and 3 bytes
+      *              after them are free
+      * @param length Number of bytes in the frame contents
+      * @return true if the frame was queued, false if it was dropped
       */
-     bool isValidNumber(const char* str);
+     bool sendFrame(uint8_t* frame, uint8_t length);
+
+     /**
+      * Helper function to send the DONE frame of a command and its returned values.
+      *
+      * @param id The command
+      * @param values The values returned by the callback
+      * @param useInts true if the values are fixed point integers
+      */
+     void sendDoneFrame(CommandId id, const Value* values, bool useInts);
+
+     /**
+      * Helper function to send the ACK of a command, as a line or a frame.
+      *
+      * @param id The command
+      * @param queued Number of moves the command adds to the motion queue
+      */
+     void sendAck(CommandId id, uint8_t queued);
+
+     /**
+      * Helper function to queue the points of a PATH frame.
+      *
+      * @param payload The flags byte followed by the points
+      * @param length Number of bytes in the payload
+      */
+     void queuePath(const uint8_t* payload, uint8_t length);
+
+     /**
+      * Helper function to switch the serial port to a new baud rate, once
+      * everything queued has been sent at the current one.
+      *
+      * @param rate The new rate
+      */
+     void switchBaud(uint32_t rate);
+
+     /**
+      * Helper function to send the POINT reply of a finished PATH point.
+      *
+      * @param tag The tag of the PATH command
+      * @param point Index of the point in its batch
+      * @return true if the reply was queued, false if it was dropped
+      */
+     bool sendPoint(uint16_t tag, uint8_t point);
+
+     /**
+      * Helper function to start sending the help message line by line.
+      *
+      * @param reply true to end the message with "DONE HELP"
+      */
+     void startHelp(bool reply);
+
+     /**
+      * Helper function to send the pending help lines that fit in the ring.
+      */
+     void sendHelp();
+
+     /**
+      * Helper function to check if the next received byte may send a response,
+      * because it starts or ends a command.
+      *
+      * @param c The next received byte
+      * @return true if a complete response must fit in the ring before it is read
+      */
+     bool needsRoom(int c) const;
+
+     /**
+      * Helper function to check if help() or GET_STATS lines are still being sent.
+      *
+      * @return true while no new command should be read
+      */
+     bool sendingLines() const;
+
+     /**
+      * Helper function to count the time from the ACK to the DONE of a command
+      * that replies without waiting, when COMMAND_PARSER_STATS is set.
+      *
+      * @param id The command
+      */
+     void recordDone(CommandId id);
+
+ #if COMMAND_PARSER_STATS
+     /**
+      * Helper function to send the histograms that fit in the ring, one line
+      * each, then "DONE GET_STATS".
+      */
+     void sendStats();
+ #endif
      
+     /**
+      * Helper function to close the token being received, if any.
+      * Resolves the command as soon as its token is complete.
+      */
+     void endToken();
+
+     /**
+      * Helper function to clear the line reader state for the next line.
+      */
+     void resetLine();
+
+     /**
+      * Helper function to validate and convert the arguments of the current
+      * command against its descriptor, without sending anything.
+      *
+      * @param values Array where the converted arguments are stored
+      * @param failed Set to the index of the argument that is not a valid number
+      * @return ARGUMENTS_OK if all the arguments are present and valid, the problem otherwise
+      */
+     ArgumentError convertArguments(Value* values, uint8_t& failed);
+
+     /**
+      * Helper function to clear the values exchanged with a callback.
+      *
+      * @return The values, MAX_ARGUMENTS of them, all zero
+      */
+     Value* clearValues();
+
+     /**
+      * Helper function to send the error of arguments that were rejected.
+      *
+      * @param id The command
+      * @param error The problem found by convertArguments() or processFrame()
+      * @param failed Index of the argument that is not a valid number
+      */
+     void reportArguments(CommandId id, ArgumentError error, uint8_t failed);
+
+     /**
+      * Helper function to run the handler of a command and send its DONE reply.
+      *
+      * @param id The command being processed
+      * @param values The parsed arguments of the command
+      */
+     void runCommand(CommandId id, Value* values);
+
+
+     /**
+      * Helper function to check if a command exchanges fixed point integers.
+      *
+      * @param id The command
+      * @return true for integer callbacks and queued moves, false for floats
+      */
+     bool usesInts(CommandId id) const;
+
+     /**
+      * Helper function to send the bare DONE line (or frame) of a command.
+      *
+      * @param id The command
+      * @param tag The tag of the command, COMMAND_NO_TAG for none
+      * @return true if the line was queued, false if it was dropped
+      */
+     bool sendDone(CommandId id, uint16_t tag);
+
      /**
       * Helper function to process the received command
-      * Parses the command and executes the appropriate action
+      * Runs the command already decoded by the line reader
       */
      void processCommand();
+
+     /**
+      * Helper function to advance the line reader with one received byte.
+      *
+      * @param c The received byte
+      */
+     void consume(char c);
+
+     /**
+      * Helper function to process a received frame in binary mode.
+      * Runs the command with the same handlers as a text line.
+      */
+     void processFrame();
+
+     /**
+      * Helper function to collect the bytes of a frame in binary mode.
+      *
+      * @param c The received byte
+      */
+     void consumeFrame(uint8_t c);
  
    public:
      /**
@@ -91,9 +542,202 @@
       * Also sets the serial timeout for reading commands.
       */
      void begin();
+
+     /**
+      * Sends an error message following the protocol format ("ERROR: message").
+      * Callbacks should report their errors with this function instead of
+      * printing to Serial, so the message keeps its place between ACK and DONE.
+      * Messages longer than RESPONSE_LINE_SIZE are cut.
+      *
+      * @param errorMessage The error message
+      */
+     void reportError(const char* errorMessage);
+
+     /**
+      * Sends an error message stored in flash, e.g. reportError(F("Motor stalled")).
+      *
+      * @param errorMessage The error message
+      */
+     void reportError(const __FlashStringHelper* errorMessage);
+
+     /**
+      * Sets what happens when a response does not fit in the transmit ring.
+      * By default it is dropped and counted in getTxStats().
+      *
+      * @param policy TxBuffer::OVERFLOW_DROP or TxBuffer::OVERFLOW_BLOCK
+      */
+     void setOverflowPolicy(TxBuffer::OverflowPolicy policy) { tx.setOverflowPolicy(policy); }
+
+     /**
+      * Returns the transmit ring counters (dropped bytes, overflows and
+      * largest number of bytes waiting).
+      *
+      * @return The counters
+      */
+     const TxBuffer::Stats& getTxStats() const { return tx.getStats(); }
+
+     /**
+      * Called from a callback to finish the command later. The parser sends
+      * ACK but not DONE, and keeps reading commands while the work goes on
+      * (e.g. GET_POSITION during a move). DONE is sent by complete(token).
+      * Only commands that return no values can be deferred.
+      *
+      * @return The token to pass to complete(), not pending() if called
+      *         outside a callback or from a command that returns values
+      */
+     CompletionToken defer();
+
+     /**
+      * Sends the DONE of a deferred command, e.g. once the move has finished.
+      * The token is cleared, so a second call does nothing.
+      *
+      * @param token The token returned by defer()
+      * @return true if DONE was sent (or the token was not pending), false if
+      *         the transmit ring was full; the token is kept to try again
+      */
+     bool complete(CompletionToken& token);
+
+     /**
+      * Sends GO_HOME, ABSOLUTE_MOVE and DELTA_MOVE to the motion queue instead
+      * of their callbacks. Each ACK then reports the free queue depth
+      * ("ACK ABSOLUTE_MOVE: 7"), and a move that does not fit is rejected
+      * with an error and its DONE.
+      *
+      * @param enabled true to queue the moves
+      */
+     void useMotionQueue(bool enabled) { motionQueueEnabled = enabled; }
+
+     /**
+      * Returns the move the executor should run, the oldest one in the queue.
+      * It stays in the queue until finishMove() is called.
+      *
+      * @return The move, or nullptr if there is none
+      */
+     const MotionCommand* currentMove() const { return moves.front(); }
+
+     /**
+      * Sends the DONE of the current move and removes it from the queue.
+      * Points of a PATH batch are reported once, with the DONE of the last
+      * point, or with a POINT reply each if the batch asked for it.
+      *
+      * @return true if the move was removed, false if there is no move or the
+      *         transmit ring was full; the move is kept to try again
+      */
+     bool finishMove();
+
+     /**
+      * Returns the motion queue, e.g. to check its free depth.
+      *
+      * @return The queue
+      */
+     const MotionQueue& getMotionQueue() const { return moves; }
+
+     /**
+      * Checks if the host switched to binary frames with the BINARY command.
+      *
+      * @return true while commands and responses are COBS frames
+      */
+     bool isBinaryMode() const { return binaryMode; }
+
+     /**
+      * Returns the current serial baud rate, changed with SET_BAUD.
+      *
+      * @return The rate
+      */
+     uint32_t getBaudRate() const { return baudRate; }
+
+     /**
+      * Checks if STREAM_POSITION is sending samples.
+      *
+      * @return true until STOP_STREAM
+      */
+     bool isStreaming() const { return streamPeriod != 0; }
+
+     /**
+      * Returns the samples of the current (or last) position stream that
+      * were not sent, because read() was called late or the transmit ring
+      * was full. STOP_STREAM also returns it.
+      *
+      * @return The number of dropped samples
+      */
+     uint32_t getDroppedSamples() const { return droppedSamples; }
+
+ #if COMMAND_PARSER_STATS
+     /**
+      * Returns the latency histograms sent by GET_STATS.
+      *
+      * @return The histograms
+      */
+     const CommandStats& getCommandStats() const { return stats; }
+
+     /**
+      * Clears the latency histograms, e.g. before a run being measured.
+      */
+     void resetCommandStats() { stats.reset(); }
+ #endif
+
+     /**
+      * Resolves a command token to its identifier, e.g. for host tools.
+      * Uses a perfect hash over the command names, so the cost is one hash
+      * and a single memcmp regardless of the number of commands.
+      *
+      * @param token The uppercase command token
+      * @param length The length of the token
+      * @return The command identifier, or CMD_UNKNOWN if there is no match
+      */
+     static CommandId lookupCommand(const char* token, size_t length);
      
      /**
-      * Configures the callback functions for various commands.
+      * Registers the callback of a command that takes no values.
+      *
+      * @param id The command, e.g. CMD_SET_HOME
+      * @param callback Function to call when the command is received
+      * @return true if the command accepts this callback type, false otherwise
+      */
+     bool on(CommandId id, VoidCallback callback);
+
+     /**
+      * Registers the callback of a command that exchanges three integer values.
+      * Values are fixed point with FIXED_POINT_DECIMALS decimals, e.g. micrometres.
+      *
+      * @param id The command, e.g. CMD_ABSOLUTE_MOVE or CMD_GET_POSITION
+      * @param callback Function to call when the command is received
+      * @return true if the command accepts this callback type, false otherwise
+      */
+     bool on(CommandId id, ThreeIntsCallback callback);
+
+     /**
+      * Registers the callback of a command that exchanges one integer value.
+      * The value is fixed point with FIXED_POINT_DECIMALS decimals.
+      *
+      * @param id The command, e.g. CMD_SET_SPEED or CMD_GET_SPEED
+      * @param callback Function to call when the command is received
+      * @return true if the command accepts this callback type, false otherwise
+      */
+     bool on(CommandId id, IntCallback callback);
+
+ #if !COMMAND_PARSER_FIXED_POINT
+     /**
+      * Registers the callback of a command that exchanges three values.
+      *
+      * @param id The command, e.g. CMD_ABSOLUTE_MOVE or CMD_GET_POSITION
+      * @param callback Function to call when the command is received
+      * @return true if the command accepts this callback type, false otherwise
+      */
+     bool on(CommandId id, ThreeFloatsCallback callback);
+
+     /**
+      * Registers the callback of a command that exchanges one value.
+      *
+      * @param id The command, e.g. CMD_SET_SPEED or CMD_GET_SPEED
+      * @param callback Function to call when the command is received
+      * @return true if the command accepts this callback type, false otherwise
+      */
+     bool on(CommandId id, FloatCallback callback);
+
+     /**
+      * Configures the callback functions for the original set of commands.
+      * Kept for existing sketches, new commands are registered with on().
       * 
       * @param setHome Function to call when SET_HOME command is received
       * @param goHome Function to call when GO_HOME command is received
@@ -118,18 +762,57 @@
       FloatCallback getMaxSpeed = nullptr,
       VoidCallback checkErrors = nullptr
     );
+ #endif
      
      /**
       * Displays a help message with available commands.
-      * This function prints all supported commands to the serial port.
+      * The lines are queued as room frees up in the transmit ring, so the
+      * message is sent over the following calls to read().
       */
      void help();
      
      /**
       * Reads and processes incoming serial commands.
       * This function should be called repeatedly in the main loop.
+      * It also sends the queued output without waiting for the serial port,
+      * and leaves incoming commands in the serial buffer while the transmit
+      * ring has no room for another response. It also sends the position
+      * samples of STREAM_POSITION when due, and restores the previous baud
+      * rate if KEEP_BAUD does not follow SET_BAUD in time.
       */
      void read();
  };
- 
+
+ // Default receive buffer of BasicCommandParser, longest command line or encoded frame
+ static constexpr size_t COMMAND_PARSER_BUFFER_SIZE = 104;
+
+ /**
+  * BasicCommandParser class - CommandParserBase with its buffers
+  *
+  * BufferSize is the longest command line, or encoded binary frame, that can
+  * be received. The arguments and the values exchanged with a callback are
+  * sized by MAX_ARGUMENTS, which no command exceeds. A small board can use
+  * e.g. BasicCommandParser<32> parser; for a few bytes of SRAM, PATH frames
+  * are then limited to the points that fit in the buffer.
+  */
+ template <size_t BufferSize = COMMAND_PARSER_BUFFER_SIZE>
+ class BasicCommandParser : public CommandParserBase {
+   static_assert(BufferSize <= 255, "BufferSize must fit in a uint8_t index");
+   static_assert(BufferSize >= 1 + 3 + mostCommandArguments() * 4 + 2,
+                 "BufferSize must hold the command frame with the most arguments");
+
+   private:
+     char buffer[BufferSize];
+     ArgumentToken argumentTokens[MAX_ARGUMENTS];
+     Value values[MAX_ARGUMENTS];
+
+   public:
+     BasicCommandParser() : CommandParserBase(buffer, BufferSize, argumentTokens, values) {}
+     BasicCommandParser(const BasicCommandParser&) = delete;
+     BasicCommandParser& operator=(const BasicCommandParser&) = delete;
+ };
+
+ // Parser with the default buffer sizes, as used by most sketches
+ typedef BasicCommandParser<> CommandParser;
+
  #endif
\ No newline at end of file
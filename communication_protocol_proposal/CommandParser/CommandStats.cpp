@@ -0,0 +1,42 @@
+/**
+ * CommandStats.cpp - Per command latency histograms for the COXIRIS Positioning
+ *                    System command parser.
+ *
+ * Each command gets two histograms, from its first received byte to its ACK
+ * and from its ACK to its DONE, with one log2 bucket per power of two
+ * microseconds. They live in the parser, take no heap and are sent with the
+ * GET_STATS command.
+ */
+
+ #include "CommandStats.h"
+
+ /**
+  * Finds the bucket of a latency.
+  * Whole bytes are skipped first, so the loop runs at most 7 single bit steps
+  * and AVR never shifts a 32 bit value more than a few times.
+  *
+  * @param microseconds The latency
+  * @return floor(log2(microseconds)), 0 for 0 us, at most STATS_BUCKETS - 1
+  */
+ uint8_t CommandStats::bucket(unsigned long microseconds) {
+   uint8_t log2 = 0;
+   while (microseconds > 0xFF) {
+     microseconds >>= 8;
+     log2 += 8;
+   }
+   while (microseconds > 1) {
+     microseconds >>= 1;
+     log2++;
+   }
+   return log2 < STATS_BUCKETS ? log2 : STATS_BUCKETS - 1;
+ }
+
+ /**
+  * Counts a latency in the histogram of a command.
+  */
+ void CommandStats::record(uint8_t command, Phase phase, unsigned long microseconds) {
+   uint16_t& count = counts[command][phase][bucket(microseconds)];
+   if (count != 0xFFFF) {
+     count++;
+   }
+ }
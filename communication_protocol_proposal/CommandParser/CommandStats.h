@@ -0,0 +1,88 @@
+/**
+ * CommandStats.h - Per command latency histograms for the COXIRIS Positioning
+ *                  System command parser.
+ *
+ * Each command gets two histograms, from its first received byte to its ACK
+ * and from its ACK to its DONE, with one log2 bucket per power of two
+ * microseconds. They live in the parser, take no heap and are sent with the
+ * GET_STATS command.
+ */
+
+ #ifndef COMMAND_STATS_H
+ #define COMMAND_STATS_H
+
+ #include <Arduino.h>
+ #include <string.h>
+ #include "CommandList.h"
+
+ // Set to 1 (e.g. with a build flag) to time every command and answer GET_STATS.
+ // It takes STATS_COMMANDS * 2 * STATS_BUCKETS * 2 bytes of SRAM (1920 bytes by
+ // default), so on small boards also lower STATS_BUCKETS
+ #ifndef COMMAND_PARSER_STATS
+ #define COMMAND_PARSER_STATS 0
+ #endif
+
+ // Buckets per histogram. Bucket b counts latencies from 2^b to 2^(b+1) - 1 us,
+ // bucket 0 also counts 0 us and the last one everything longer (8.4 s by default)
+ #ifndef STATS_BUCKETS
+ #define STATS_BUCKETS 24
+ #endif
+
+ static_assert(STATS_BUCKETS >= 2 && STATS_BUCKETS <= 32, "STATS_BUCKETS must be between 2 and 32");
+
+ #define COMMAND_ONE(...) + 1
+ // Number of commands, CommandParserBase::CMD_COUNT without including the parser
+ static constexpr uint8_t STATS_COMMANDS = 0 COMMAND_LIST(COMMAND_ONE);
+ #undef COMMAND_ONE
+
+ /**
+  * CommandStats class - Fixed size latency histograms, one pair per command
+  *
+  * Counts saturate at 65535 instead of wrapping, so a long run never shows a
+  * busy bucket as an empty one.
+  */
+ class CommandStats {
+   public:
+     // Part of the command that is timed
+     enum Phase : uint8_t {
+       STATS_RECEIVE,  // From the first byte of the line or frame to the ACK
+       STATS_RUN,      // From the ACK to the DONE, including the time a move waits in the queue
+       STATS_PHASES    // Number of phases
+     };
+
+     /**
+      * Finds the bucket of a latency.
+      *
+      * @param microseconds The latency
+      * @return floor(log2(microseconds)), 0 for 0 us, at most STATS_BUCKETS - 1
+      */
+     static uint8_t bucket(unsigned long microseconds);
+
+     /**
+      * Counts a latency in the histogram of a command.
+      *
+      * @param command The CommandId, below STATS_COMMANDS
+      * @param phase The part of the command that was timed
+      * @param microseconds The latency
+      */
+     void record(uint8_t command, Phase phase, unsigned long microseconds);
+
+     /**
+      * Returns the histogram of a command.
+      *
+      * @param command The CommandId, below STATS_COMMANDS
+      * @param phase The part of the command that was timed
+      * @return STATS_BUCKETS counts, bucket 0 first
+      */
+     const uint16_t* histogram(uint8_t command, Phase phase) const { return counts[command][phase]; }
+
+     /**
+      * Clears every histogram.
+      */
+     void reset() { memset(counts, 0, sizeof(counts)); }
+
+   private:
+     uint16_t counts[STATS_COMMANDS][STATS_PHASES][STATS_BUCKETS] = {};
+ };
+
+ #endif
@@ -0,0 +1,176 @@
+/**
+ * CommandTable.h - Command descriptor table for the COXIRIS Positioning System
+ *                  command parser.
+ *
+ * Every command is described by one read-only row: its name, the arguments it
+ * takes, the values it returns, how it is handled and its help text. Dispatch,
+ * argument validation and help() are all driven from this table, which is
+ * generated from COMMAND_LIST, so adding a command only means adding a row to
+ * CommandList.h; its hash slot is found at compile time.
+ *
+ * The table and all its text live in flash (PROGMEM), so on AVR they take no
+ * SRAM. Rows are read with readCommand() and their text is appended through
+ * the __FlashStringHelper overloads of the response line.
+ */
+
+ #ifndef COMMAND_TABLE_H
+ #define COMMAND_TABLE_H
+
+ #include "CommandParser.h"
+
+ // How the parser runs a command
+ enum HandlerType : uint8_t {
+   HANDLER_HELP,        // Built-in, prints the help message
+   HANDLER_ID,          // Built-in, returns DEVICE_ID
+   HANDLER_VOID,        // Calls a VoidCallback
+   HANDLER_SET_VALUES,  // Parses the arguments and passes them to the callback
+   HANDLER_GET_VALUES,  // The callback fills the values returned with DONE
+   HANDLER_MOVE,        // Queued for the motion executor, or run like HANDLER_SET_VALUES
+                        // when the motion queue is not used
+   HANDLER_BINARY,      // Built-in, toggles the binary framed mode after its DONE
+   HANDLER_PATH,        // Built-in, queues the points of a binary frame as absolute moves
+   HANDLER_SET_BAUD,    // Built-in, switches the baud rate until confirmed or timed out
+   HANDLER_KEEP_BAUD,   // Built-in, confirms the new baud rate
+   HANDLER_BAUD_RATES,  // Built-in, returns SERIAL_BAUD_RATES
+   HANDLER_STREAM,      // Built-in, starts sending the position from read()
+   HANDLER_STOP_STREAM, // Built-in, stops the stream and returns its dropped samples
+   HANDLER_STATS        // Built-in, sends the latency histograms (COMMAND_PARSER_STATS)
+ };
+
+ // Constraint applied to every argument of a command
+ enum ArgumentType : uint8_t {
+   ARG_NONE,            // The command takes no arguments
+   ARG_NUMBER,          // Any number
+   ARG_POSITIVE_NUMBER  // A number greater than zero
+ };
+
+ // Read-only description of a command
+ struct CommandDescriptor {
+   const char* name;      // Command token (in flash)
+   uint8_t nameLength;    // Length of the command token
+   uint8_t handler;       // HandlerType
+   uint8_t arity;         // Number of arguments (HANDLER_SET_VALUES, HANDLER_MOVE)
+   uint8_t argumentType;  // ArgumentType of every argument
+   uint8_t results;       // Number of returned values (HANDLER_GET_VALUES)
+   uint8_t decimals;      // Decimals used to print the returned values
+   const char* usage;     // Command with its arguments, as shown in help() (in flash)
+   const char* help;      // Description shown in help() (in flash)
+ };
+
+ #define COMMAND_NAME_SIZE 16  // Longest command name
+
+ // Name, usage and help text of every command, in flash
+ #define COMMAND_TEXT(name, handler, arity, argumentType, results, decimals, usage, help) \
+   static constexpr char TEXT_NAME_##name[] PROGMEM = #name; \
+   static constexpr char TEXT_USAGE_##name[] PROGMEM = usage; \
+   static constexpr char TEXT_HELP_##name[] PROGMEM = help;
+
+ COMMAND_LIST(COMMAND_TEXT)
+
+ #undef COMMAND_TEXT
+
+ #define COMMAND_ROW(name, handler, arity, argumentType, results, decimals, usage, help) \
+   { TEXT_NAME_##name, sizeof(#name) - 1, handler, arity, argumentType, results, decimals, \
+     TEXT_USAGE_##name, TEXT_HELP_##name },
+
+ // Command descriptors, indexed by CommandId
+ static constexpr CommandDescriptor COMMANDS[CommandParserBase::CMD_COUNT] PROGMEM = {
+   COMMAND_LIST(COMMAND_ROW)
+ };
+
+ #undef COMMAND_ROW
+
+ /**
+  * Copies the descriptor of a command from flash.
+  *
+  * @param id The command, below CMD_COUNT
+  * @return The descriptor, its text pointers still point to flash
+  */
+ static inline CommandDescriptor readCommand(uint8_t id) {
+   CommandDescriptor command;
+   memcpy_P(&command, &COMMANDS[id], sizeof(command));
+   return command;
+ }
+
+ /**
+  * Marks a pointer to flash text so it is appended with the F() overloads.
+  *
+  * @param text Text stored with PROGMEM
+  * @return The same pointer, as a __FlashStringHelper
+  */
+ static inline const __FlashStringHelper* flashText(const char* text) {
+   return reinterpret_cast<const __FlashStringHelper*>(text);
+ }
+
+ #define COMMAND_HASH_SIZE 64  // Number of hash slots (power of two)
+
+ /**
+  * Perfect hash over the command names. It only looks at the length and the
+  * first, middle and last characters, so it is O(1) in the token length. The
+  * last character tells apart names such as GET_SPEED and GET_STATS.
+  * If a new command collides, change the multipliers; the static_assert
+  * below rejects any table that is not collision free.
+  */
+ static constexpr uint8_t commandHash(const char* token, size_t length) {
+   return (uint8_t)(length + (uint8_t)token[0] + 2 * (uint8_t)token[length / 2] + 4 * (uint8_t)token[length - 1]) &
+          (COMMAND_HASH_SIZE - 1);
+ }
+
+ // Hash slot to CommandId, filled at compile time from COMMANDS
+ struct CommandSlots {
+   uint8_t ids[COMMAND_HASH_SIZE];  // CMD_UNKNOWN for empty slots, read with pgm_read_byte()
+ };
+
+ /**
+  * Finds the command that hashes to a slot, at compile time.
+  *
+  * @param slot The slot
+  * @param id First command to check
+  * @return The first command in the slot, or CMD_UNKNOWN if there is none
+  */
+ static constexpr uint8_t commandInSlot(size_t slot, uint8_t id = 0) {
+   return id == CommandParserBase::CMD_COUNT ? (uint8_t)CommandParserBase::CMD_UNKNOWN :
+          commandHash(COMMANDS[id].name, COMMANDS[id].nameLength) == slot ? id : commandInSlot(slot, id + 1);
+ }
+
+ // List of slot numbers 0 to Count - 1, to fill every slot in one initializer
+ template <size_t... Slots> struct SlotList {};
+ template <size_t Count, size_t... Slots> struct MakeSlotList : MakeSlotList<Count - 1, Count - 1, Slots...> {};
+ template <size_t... Slots> struct MakeSlotList<0, Slots...> {
+   typedef SlotList<Slots...> type;
+ };
+
+ /**
+  * Fills the hash slots, at compile time.
+  *
+  * @return The slots, each holding the command that hashes to it
+  */
+ template <size_t... Slots>
+ static constexpr CommandSlots fillCommandSlots(SlotList<Slots...>) {
+   return CommandSlots{{ commandInSlot(Slots)... }};
+ }
+
+ static constexpr CommandSlots COMMAND_SLOTS PROGMEM = fillCommandSlots(MakeSlotList<COMMAND_HASH_SIZE>::type());
+
+ // Checks at compile time that every command hashes to its own slot, so no two
+ // commands share one
+ static constexpr bool commandSlotsValid(uint8_t id) {
+   return id == CommandParserBase::CMD_COUNT ||
+          (COMMAND_SLOTS.ids[commandHash(COMMANDS[id].name, COMMANDS[id].nameLength)] == id &&
+           commandSlotsValid(id + 1));
+ }
+
+ static_assert(commandSlotsValid(0), "Two commands share a hash slot, change the multipliers of commandHash()");
+
+ // Checks at compile time that no command exchanges more than MAX_ARGUMENTS values
+ // and that every name fits in COMMAND_NAME_SIZE
+ static constexpr bool commandSizesValid(uint8_t id) {
+   return id == CommandParserBase::CMD_COUNT ||
+          (COMMANDS[id].arity <= MAX_ARGUMENTS && COMMANDS[id].results <= MAX_ARGUMENTS &&
+           COMMANDS[id].nameLength <= COMMAND_NAME_SIZE && COMMANDS[id].decimals <= 3 &&
+           commandSizesValid(id + 1));
+ }
+
+ static_assert(commandSizesValid(0), "A command exceeds MAX_ARGUMENTS, COMMAND_NAME_SIZE or 3 decimals");
+
+ #endif
@@ -0,0 +1,70 @@
+/**
+ * FrameCodec.cpp - Binary frame encoding for the COXIRIS Positioning System
+ *                  command parser.
+ *
+ * It implements the COBS framing and the CRC16 used by the binary protocol
+ * mode, working in place so no second buffer is needed.
+ */
+
+ #include "FrameCodec.h"
+
+ // CRC16-CCITT of each nibble value, so a byte costs two lookups instead of eight shifts
+ static const uint16_t CRC_NIBBLES[16] PROGMEM = {
+   0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+   0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+ };
+
+ /**
+  * Computes the CRC16-CCITT of a block of bytes.
+  */
+ uint16_t FrameCodec::crc16(const uint8_t* data, size_t length) {
+   uint16_t crc = 0xFFFF;
+   for (size_t i = 0; i < length; i++) {
+     crc = (crc << 4) ^ pgm_read_word(&CRC_NIBBLES[(crc >> 12) ^ (data[i] >> 4)]);
+     crc = (crc << 4) ^ pgm_read_word(&CRC_NIBBLES[(crc >> 12) ^ (data[i] & 0x0F)]);
+   }
+   return crc;
+ }
+
+ /**
+  * Encodes a frame in place.
+  * Every zero byte is replaced by the distance to the next zero (or to the
+  * end), and buffer[0] holds the distance to the first one. With fewer than
+  * 254 bytes no extra code byte is ever needed, so nothing has to move.
+  */
+ size_t FrameCodec::encode(uint8_t* buffer, size_t length) {
+   size_t code = 0;  // Position of the code byte being filled
+   for (size_t i = 1; i <= length; i++) {
+     if (buffer[i] == 0) {
+       buffer[code] = i - code;
+       code = i;
+     }
+   }
+   buffer[code] = length + 1 - code;
+   buffer[length + 1] = FRAME_DELIMITER;
+   return length + 2;
+ }
+
+ /**
+  * Decodes a frame in place.
+  * Each code byte gives the distance to the next one; the position it points
+  * to held a zero, except for the last group of the frame.
+  */
+ int FrameCodec::decode(uint8_t* buffer, size_t length) {
+   size_t read = 0;
+   size_t write = 0;
+   while (read < length) {
+     uint8_t code = buffer[read];
+     if (code == 0 || read + code > length) {
+       return -1;
+     }
+     read++;
+     for (uint8_t i = 1; i < code; i++) {
+       buffer[write++] = buffer[read++];
+     }
+     if (code < 0xFF && read < length) {
+       buffer[write++] = 0;
+     }
+   }
+   return (int)write;
+ }
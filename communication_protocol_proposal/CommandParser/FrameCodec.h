@@ -0,0 +1,59 @@
+/**
+ * FrameCodec.h - Binary frame encoding for the COXIRIS Positioning System
+ *                command parser.
+ *
+ * It implements the COBS framing and the CRC16 used by the binary protocol
+ * mode, working in place so no second buffer is needed.
+ */
+
+ #ifndef FRAME_CODEC_H
+ #define FRAME_CODEC_H
+
+ #include <Arduino.h>
+
+ #define FRAME_MAX_DATA 253  // Longest frame contents (opcode, tag, payload and CRC) for in place COBS
+ #define FRAME_OVERHEAD 7    // Bytes a frame adds to its payload: COBS code, kind, tag, CRC and delimiter
+ #define FRAME_DELIMITER 0   // Byte that ends every encoded frame
+
+ /**
+  * FrameCodec class - COBS framing and CRC16-CCITT
+  *
+  * A frame is [kind or opcode][tag, 2 bytes][payload][CRC16, 2 bytes], all
+  * little endian. COBS removes every zero byte from it, so a single zero
+  * delimits frames and a lost byte only corrupts one frame. For frames up to
+  * FRAME_MAX_DATA bytes COBS adds exactly one byte, which is what allows the
+  * encoding to be done in place.
+  */
+ class FrameCodec {
+   public:
+     /**
+      * Computes the CRC16-CCITT (polynomial 0x1021, initial value 0xFFFF).
+      *
+      * @param data The bytes
+      * @param length Number of bytes
+      * @return The CRC
+      */
+     static uint16_t crc16(const uint8_t* data, size_t length);
+
+     /**
+      * Encodes a frame in place. The contents must start at buffer[1];
+      * buffer[0] is overwritten with the first COBS code and the delimiter
+      * is written after the last byte.
+      *
+      * @param buffer The frame, with one free byte before and after it
+      * @param length Number of bytes in the frame, at most FRAME_MAX_DATA
+      * @return Number of bytes to send from buffer[0] (length + 2)
+      */
+     static size_t encode(uint8_t* buffer, size_t length);
+
+     /**
+      * Decodes a frame in place, without its delimiter.
+      *
+      * @param buffer The encoded frame
+      * @param length Number of encoded bytes
+      * @return Number of decoded bytes, or -1 if the frame is malformed
+      */
+     static int decode(uint8_t* buffer, size_t length);
+ };
+
+ #endif
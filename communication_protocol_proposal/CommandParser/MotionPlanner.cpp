@@ -0,0 +1,135 @@
+/**
+ * MotionPlanner.cpp - Look-ahead planner for the moves queued by the COXIRIS
+ *                     Positioning System command parser.
+ *
+ * It computes the speed at every junction between queued moves, so a
+ * continuous path is run at cruise speed instead of stopping after each move.
+ */
+
+ #include "MotionPlanner.h"
+
+ #define PLANNER_STRAIGHT 0.999999f  // Cosine above which a junction is taken as straight
+
+ /**
+  * Helper function to compute the highest squared speed at a junction.
+  *
+  * The corner is rounded with a circle that stays within the deviation of the
+  * junction, and the speed is the one whose centripetal acceleration on that
+  * circle equals the acceleration: v^2 = a * r, r = d * sin(θ/2) / (1 - sin(θ/2)).
+  *
+  * @param previous Unit vector of the move before the junction
+  * @param next Unit vector of the move after the junction
+  * @return The squared speed in (mm/s)^2
+  */
+ float MotionPlanner::junctionSpeedSquared(const float previous[MOTION_AXES], const float next[MOTION_AXES]) const {
+   float cosine = 0;
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     cosine -= previous[axis] * next[axis];
+   }
+   if (cosine < -PLANNER_STRAIGHT) {
+     return speed * speed;
+   }
+   if (cosine > PLANNER_STRAIGHT) {
+     return 0;
+   }
+   float sinHalf = sqrt(0.5f * (1 - cosine));
+   float limit = acceleration * deviation * sinHalf / (1 - sinHalf);
+   return limit < speed * speed ? limit : speed * speed;
+ }
+
+ /**
+  * Moves a position to where a queued move ends.
+  *
+  * @param move The move (CMD_GO_HOME, CMD_ABSOLUTE_MOVE or CMD_DELTA_MOVE)
+  * @param position Position where the move starts, replaced with where it ends
+  */
+ void MotionPlanner::advance(const MotionCommand& move, int32_t position[MOTION_AXES]) {
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     if (move.command == CommandParserBase::CMD_GO_HOME) {
+       position[axis] = 0;
+     } else if (move.command == CommandParserBase::CMD_DELTA_MOVE) {
+       position[axis] += move.values[axis];
+     } else {
+       position[axis] = move.values[axis];
+     }
+   }
+ }
+
+ /**
+  * Plans the moves in the queue from the given one on, the first planned
+  * move starting at the given position and speed.
+  *
+  * @param queue The motion queue, e.g. parser.getMotionQueue()
+  * @param start Position where the first planned move starts, fixed point
+  * @param startSpeed Speed at the start of the first planned move in mm/s
+  * @param first Position in the queue of the first move to plan
+  */
+ void MotionPlanner::plan(const MotionQueue& queue, const int32_t start[MOTION_AXES], float startSpeed, uint8_t first) {
+   float unit = 1;
+   for (uint8_t i = 0; i < FIXED_POINT_DECIMALS; i++) {
+     unit /= 10;
+   }
+
+   // Lengths and squared junction speeds, the entry speeds are kept squared
+   // until the end
+   int32_t position[MOTION_AXES];
+   float previous[MOTION_AXES] = {0};
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     position[axis] = start[axis];
+   }
+   count = queue.size() > first ? queue.size() - first : 0;
+   for (uint8_t i = 0; i < count; i++) {
+     int32_t target[MOTION_AXES];
+     memcpy(target, position, sizeof(target));
+     advance(*queue.at(first + i), target);
+     float direction[MOTION_AXES];
+     float length = 0;
+     for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+       direction[axis] = (target[axis] - position[axis]) * unit;
+       length += direction[axis] * direction[axis];
+       position[axis] = target[axis];
+     }
+     length = sqrt(length);
+     moves[i].length = length;
+     moves[i].cruiseSpeed = speed;
+     for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+       // A move of zero length keeps the direction of the previous one
+       direction[axis] = length > 0 ? direction[axis] / length : previous[axis];
+     }
+     moves[i].entrySpeed = i == 0 ? startSpeed * startSpeed : junctionSpeedSquared(previous, direction);
+     for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+       previous[axis] = direction[axis];
+     }
+   }
+
+   // Backward pass: the last move ends at rest and every move must be able to
+   // slow down to the entry speed of the next one
+   float exit = 0;
+   for (uint8_t i = count; i-- > 1;) {
+     moves[i].exitSpeed = exit;
+     float reachable = exit + 2 * acceleration * moves[i].length;
+     if (moves[i].entrySpeed > reachable) {
+       moves[i].entrySpeed = reachable;
+     }
+     exit = moves[i].entrySpeed;
+   }
+   if (count > 0) {
+     moves[0].exitSpeed = exit;
+   }
+
+   // Forward pass: every move must be able to speed up to its exit speed
+   for (uint8_t i = 0; i < count; i++) {
+     float reachable = moves[i].entrySpeed + 2 * acceleration * moves[i].length;
+     if (moves[i].exitSpeed > reachable) {
+       moves[i].exitSpeed = reachable;
+     }
+     if (i + 1 < count) {
+       moves[i + 1].entrySpeed = moves[i].exitSpeed;
+     }
+   }
+
+   for (uint8_t i = 0; i < count; i++) {
+     moves[i].entrySpeed = sqrt(moves[i].entrySpeed);
+     moves[i].exitSpeed = sqrt(moves[i].exitSpeed);
+   }
+ }
@@ -0,0 +1,131 @@
+/**
+ * MotionPlanner.h - Look-ahead planner for the moves queued by the COXIRIS
+ *                   Positioning System command parser.
+ *
+ * It computes the speed at every junction between queued moves, so a
+ * continuous path is run at cruise speed instead of stopping after each move.
+ */
+
+ #ifndef MOTION_PLANNER_H
+ #define MOTION_PLANNER_H
+
+ #include <Arduino.h>
+ #include "CommandParser.h"
+
+ #ifndef PLANNER_SPEED
+ #define PLANNER_SPEED 10.0f           // Default cruise speed in mm/s
+ #endif
+ #ifndef PLANNER_ACCELERATION
+ #define PLANNER_ACCELERATION 500.0f   // Default acceleration in mm/s^2
+ #endif
+ #ifndef PLANNER_MIN_ACCELERATION
+ #define PLANNER_MIN_ACCELERATION 1.0f // Lowest acceleration in mm/s^2, keeps the ramps finite
+ #endif
+ #ifndef PLANNER_DEVIATION
+ #define PLANNER_DEVIATION 0.01f       // Default junction deviation in mm
+ #endif
+
+ // Speeds planned for one queued move
+ struct PlannedMove {
+   float length;       // Distance in mm
+   float entrySpeed;   // Speed at the start of the move in mm/s
+   float cruiseSpeed;  // Highest speed of the move in mm/s
+   float exitSpeed;    // Speed at the end of the move in mm/s, the entry speed of the next one
+ };
+
+ /**
+  * MotionPlanner class - Junction speeds over the motion queue
+  *
+  * Each junction speed is limited by the deviation tolerance: the path may
+  * round a corner by at most that distance, so a straight junction is taken
+  * at cruise speed and a reversal almost stops. A backward and a forward pass
+  * then make every speed reachable with the acceleration over the length of
+  * the moves. The last queued move always ends at rest, so the plan is safe
+  * even if no more moves arrive.
+  *
+  * plan() is run once per queue change, not per step, so it uses float; the
+  * per tick work is left to the profile generator.
+  */
+ class MotionPlanner {
+   private:
+     PlannedMove moves[MOTION_QUEUE_DEPTH];
+     uint8_t count = 0;                       // Moves planned by the last plan()
+     float speed = PLANNER_SPEED;
+     float acceleration = PLANNER_ACCELERATION;
+     float deviation = PLANNER_DEVIATION;
+
+     /**
+      * Helper function to compute the highest squared speed at a junction.
+      *
+      * @param previous Unit vector of the move before the junction
+      * @param next Unit vector of the move after the junction
+      * @return The squared speed in (mm/s)^2
+      */
+     float junctionSpeedSquared(const float previous[MOTION_AXES], const float next[MOTION_AXES]) const;
+
+   public:
+     /**
+      * Moves a position to where a queued move ends.
+      *
+      * @param move The move (CMD_GO_HOME, CMD_ABSOLUTE_MOVE or CMD_DELTA_MOVE)
+      * @param position Position where the move starts, fixed point; it is
+      *                 replaced with where the move ends
+      */
+     static void advance(const MotionCommand& move, int32_t position[MOTION_AXES]);
+
+     /**
+      * Sets the cruise speed, e.g. from the SET_SPEED callback.
+      *
+      * @param cruiseSpeed Speed in mm/s
+      */
+     void setSpeed(float cruiseSpeed) { speed = cruiseSpeed; }
+
+     /**
+      * Sets the acceleration used to reach the planned speeds. Lower values,
+      * including 0 and NaN, are raised to PLANNER_MIN_ACCELERATION.
+      *
+      * @param value Acceleration in mm/s^2
+      */
+     void setAcceleration(float value) {
+       acceleration = value > PLANNER_MIN_ACCELERATION ? value : PLANNER_MIN_ACCELERATION;
+     }
+
+     /**
+      * Returns the acceleration used by the plan, the one the profile of the
+      * moves must use.
+      *
+      * @return Acceleration in mm/s^2
+      */
+     float getAcceleration() const { return acceleration; }
+
+     /**
+      * Sets how far the path may deviate from a corner, a larger tolerance
+      * allows faster corners.
+      *
+      * @param tolerance Junction deviation in mm
+      */
+     void setDeviation(float tolerance) { deviation = tolerance; }
+
+     /**
+      * Plans the moves in the queue from the given one on, the first planned
+      * move starting at the given position and speed. Should be called
+      * whenever the queue changes.
+      *
+      * @param queue The motion queue, e.g. parser.getMotionQueue()
+      * @param start Position where the first planned move starts, fixed point
+      * @param startSpeed Speed at the start of the first planned move in mm/s
+      * @param first Position in the queue of the first move to plan, moves
+      *              before it are already being executed (0 by default)
+      */
+     void plan(const MotionQueue& queue, const int32_t start[MOTION_AXES], float startSpeed, uint8_t first = 0);
+
+     /**
+      * Returns the plan of a queued move.
+      *
+      * @param index Position among the planned moves, 0 for the first one
+      * @return The planned speeds, or nullptr if the move was not planned
+      */
+     const PlannedMove* getMove(uint8_t index) const { return index < count ? &moves[index] : nullptr; }
+ };
+
+ #endif
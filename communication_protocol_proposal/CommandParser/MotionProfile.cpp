@@ -0,0 +1,192 @@
+/**
+ * MotionProfile.cpp - Fixed point velocity profiles for the moves of the COXIRIS
+ *                     Positioning System command parser.
+ *
+ * It turns a planned move into acceleration, cruise and deceleration phases
+ * once, so following the move on every tick only takes a few integer adds.
+ */
+
+ #include "MotionProfile.h"
+
+ /**
+  * Helper function to convert a value to fixed point, rounding to nearest.
+  *
+  * @param value The value
+  * @param one The fixed point value of 1, e.g. 65536 for Q16
+  * @return The fixed point value
+  */
+ static int32_t toFixed(float value, float one) {
+   return (int32_t)(value * one + (value < 0 ? -0.5f : 0.5f));
+ }
+
+ /**
+  * Helper function to add a phase.
+  *
+  * @param ticks Duration in ticks
+  * @param acceleration Acceleration at its start, in units per tick^2
+  * @param jerk Change of the acceleration per tick, in units per tick^3
+  * @param endSpeed Speed at its end, in units per tick
+  */
+ void MotionProfile::addPhase(uint32_t ticks, float acceleration, float jerk, float endSpeed) {
+   if (ticks == 0) {
+     return;
+   }
+   Phase& added = phases[phaseCount++];
+   added.ticks = ticks;
+   added.acceleration = toFixed(acceleration, 16777216.0f);
+   added.jerk = toFixed(jerk, 16777216.0f);
+   added.endSpeed = toFixed(endSpeed, 65536.0f);
+ }
+
+ /**
+  * Helper function to add the phases of a speed ramp.
+  *
+  * An S-curve ramp raises the acceleration to its peak during the first half
+  * of the ticks and lowers it back to 0 during the second half, so its peak is
+  * twice the mean acceleration of the ramp.
+  *
+  * @param from Speed at the start of the ramp, in units per tick
+  * @param to Speed at the end of the ramp, in units per tick
+  * @param ticks Duration of the ramp in ticks, even for an S-curve
+  */
+ void MotionProfile::addRamp(float from, float to, uint32_t ticks) {
+   if (ticks == 0) {
+     return;
+   }
+   if (shape == PROFILE_S_CURVE) {
+     uint32_t half = ticks / 2;
+     float peak = (to - from) / half;
+     addPhase(half, 0, peak / half, (from + to) / 2);
+     addPhase(half, peak, -peak / half, to);
+   } else {
+     addPhase(ticks, (to - from) / ticks, 0, to);
+   }
+ }
+
+ /**
+  * Computes the phases of a move.
+  *
+  * The ramps and the cruise are rounded up to whole ticks (the ramps to an
+  * even number for an S-curve), and the cruise speed is then lowered so they
+  * cover exactly the length of the move. Rounding up means the speed and the
+  * mean acceleration of each ramp are never exceeded.
+  *
+  * @param move The planned move, e.g. planner.getMove(0)
+  * @param plannerAcceleration Acceleration in mm/s^2, the one of the planner;
+  *                            it is raised to PLANNER_MIN_ACCELERATION, as in
+  *                            the planner, so the ramps have a finite length
+  */
+ void MotionProfile::prepare(const PlannedMove& move, float plannerAcceleration) {
+   float unit = 1;
+   for (uint8_t i = 0; i < FIXED_POINT_DECIMALS; i++) {
+     unit *= 10;
+   }
+   if (!(plannerAcceleration > PLANNER_MIN_ACCELERATION)) {
+     plannerAcceleration = PLANNER_MIN_ACCELERATION;
+   }
+   float rate = PROFILE_TICK_RATE;
+   float total = move.length * unit;
+   float entry = move.entrySpeed * unit / rate;
+   float exit = move.exitSpeed * unit / rate;
+   float cruise = move.cruiseSpeed * unit / rate;
+   float change = plannerAcceleration * unit / (rate * rate);
+
+   if (2 * cruise * cruise - entry * entry - exit * exit > 2 * change * total) {
+     // Too short to reach the cruise speed, the ramps meet
+     cruise = sqrt(change * total + (entry * entry + exit * exit) / 2);
+   }
+   // After the ramps meet, so a move the planner left too short to change
+   // speed still gets ramps of a positive length
+   if (cruise < entry) {
+     cruise = entry;
+   }
+   if (cruise < exit) {
+     cruise = exit;
+   }
+
+   uint32_t up = (uint32_t)ceil((cruise - entry) / change);
+   uint32_t down = (uint32_t)ceil((cruise - exit) / change);
+   if (shape == PROFILE_S_CURVE) {
+     up += up & 1;
+     down += down & 1;
+   }
+   float ramps = (up * (entry + cruise) + down * (cruise + exit)) / 2;
+   // Rounded up like the ramps, so the adjusted cruise speed can only go down
+   uint32_t flat = cruise > 0 && total > ramps ? (uint32_t)ceil((total - ramps) / cruise) : 0;
+   float span = (up + down) / 2.0f + flat;
+   if (span > 0) {
+     cruise = (total - (up * entry + down * exit) / 2) / span;
+     // A move of a few ticks can bring the cruise speed below the entry or
+     // exit speed; the ramps are kept within the acceleration and the last
+     // tick takes up the difference
+     float highest = entry + up * change < exit + down * change ? entry + up * change : exit + down * change;
+     float lowest = entry - up * change > exit - down * change ? entry - up * change : exit - down * change;
+     if (cruise > highest) {
+       cruise = highest;
+     }
+     if (cruise < lowest) {
+       cruise = lowest;
+     }
+     if (cruise < 0) {
+       cruise = 0;
+     }
+   }
+
+   phaseCount = 0;
+   addRamp(entry, cruise, up);
+   addPhase(flat, 0, 0, cruise);
+   addRamp(cruise, exit, down);
+
+   length = toFixed(total, 1);
+   speed = toFixed(entry, 65536.0f);
+   speedFraction = 0;
+   fraction = 0;
+   phase = 0;
+   if (phaseCount > 0) {
+     distance = 0;
+     remaining = phases[0].ticks;
+     acceleration = phases[0].acceleration;
+   } else {
+     distance = length;
+   }
+ }
+
+ /**
+  * Advances the move by one tick.
+  *
+  * The distance is integrated with the mean of the speeds at the start and
+  * the end of the tick, which is exact for constant acceleration.
+  *
+  * @return true while the move goes on, false once it is finished
+  */
+ bool MotionProfile::tick() {
+   if (phase >= phaseCount) {
+     return false;
+   }
+   const Phase& current = phases[phase];
+   int32_t previous = speed;
+   acceleration += current.jerk;
+   // The Q24 remainder is carried over, so a low acceleration is not lost
+   int32_t change = acceleration + speedFraction;
+   speed += change >> 8;
+   speedFraction = (uint8_t)change;
+   if (speed < 0) {
+     speed = 0;
+   }
+   uint32_t travelled = fraction + ((uint32_t)(previous + speed) >> 1);
+   distance += travelled >> 16;
+   fraction = (uint16_t)travelled;
+
+   if (--remaining == 0) {
+     speed = current.endSpeed;
+     speedFraction = 0;
+     if (++phase < phaseCount) {
+       remaining = phases[phase].ticks;
+       acceleration = phases[phase].acceleration;
+     } else {
+       distance = length;
+       fraction = 0;
+     }
+   }
+   return phase < phaseCount;
+ }
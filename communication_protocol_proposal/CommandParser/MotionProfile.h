@@ -0,0 +1,133 @@
+/**
+ * MotionProfile.h - Fixed point velocity profiles for the moves of the COXIRIS
+ *                   Positioning System command parser.
+ *
+ * It turns a planned move into acceleration, cruise and deceleration phases
+ * once, so following the move on every tick only takes a few integer adds.
+ */
+
+ #ifndef MOTION_PROFILE_H
+ #define MOTION_PROFILE_H
+
+ #include <Arduino.h>
+ #include "MotionPlanner.h"
+
+ #ifndef PROFILE_TICK_RATE
+ #define PROFILE_TICK_RATE 1000  // Calls to tick() per second, in Hz
+ #endif
+ #define PROFILE_MAX_PHASES 5    // Two ramps of two phases each for an S-curve, plus cruise
+
+ /**
+  * MotionProfile class - Trapezoidal and S-curve speed profiles in fixed point
+  *
+  * prepare() splits a move into phases of a whole number of ticks, each with
+  * a constant jerk. The trapezoid ramps change the speed at a constant
+  * acceleration; the S-curve ramps raise the acceleration from 0 to twice the
+  * planner acceleration and back, so they take the same time and distance
+  * with no acceleration steps. Both shapes therefore follow the speeds of the
+  * planner.
+  *
+  * Internally the speed is in Q16 fixed point units per tick and the
+  * acceleration in Q24 fixed point units per tick^2, where the unit is the one
+  * of the queued values (FIXED_POINT_DECIMALS decimals, micrometres for mm).
+  * Rounding errors are removed at the end of each phase, where the speed is
+  * set to its exact value, and at the end of the move, which always lands on
+  * its length.
+  */
+ class MotionProfile {
+   public:
+     // Shape of the speed ramps
+     enum Shape : uint8_t {
+       PROFILE_TRAPEZOID,  // Constant acceleration
+       PROFILE_S_CURVE     // Constant jerk, the acceleration has no steps
+     };
+
+   private:
+     // Part of the move with a constant jerk
+     struct Phase {
+       uint32_t ticks;         // Duration in ticks
+       int32_t acceleration;   // Acceleration at its start, Q24 units per tick^2
+       int32_t jerk;           // Change of the acceleration per tick, Q24 units per tick^3
+       int32_t endSpeed;       // Speed at its end, Q16 units per tick
+     };
+
+     Phase phases[PROFILE_MAX_PHASES];
+     uint8_t phaseCount = 0;
+     uint8_t phase = 0;              // Phase being followed
+     uint32_t remaining = 0;         // Ticks left in the phase
+     int32_t acceleration = 0;       // Q24 units per tick^2
+     int32_t speed = 0;              // Q16 units per tick
+     uint8_t speedFraction = 0;      // Q24 part of the speed below Q16
+     uint16_t fraction = 0;          // Fraction of unit travelled, Q16
+     int32_t distance = 0;           // Units travelled
+     int32_t length = 0;             // Units to travel
+     Shape shape = PROFILE_TRAPEZOID;
+
+     /**
+      * Helper function to add the phases of a speed ramp.
+      *
+      * @param from Speed at the start of the ramp, in units per tick
+      * @param to Speed at the end of the ramp, in units per tick
+      * @param ticks Duration of the ramp in ticks
+      */
+     void addRamp(float from, float to, uint32_t ticks);
+
+     /**
+      * Helper function to add a phase.
+      *
+      * @param ticks Duration in ticks
+      * @param acceleration Acceleration at its start, in units per tick^2
+      * @param jerk Change of the acceleration per tick, in units per tick^3
+      * @param endSpeed Speed at its end, in units per tick
+      */
+     void addPhase(uint32_t ticks, float acceleration, float jerk, float endSpeed);
+
+   public:
+     /**
+      * Selects the shape of the ramps of the next prepared moves.
+      *
+      * @param rampShape PROFILE_TRAPEZOID (default) or PROFILE_S_CURVE
+      */
+     void setShape(Shape rampShape) { shape = rampShape; }
+
+     /**
+      * Computes the phases of a move. The speeds of the move must be reachable
+      * with the acceleration, as the ones given by MotionPlanner are; the
+      * cruise speed is lowered when the move is too short to reach it.
+      *
+      * @param move The planned move, e.g. planner.getMove(0)
+      * @param plannerAcceleration Acceleration in mm/s^2, the one of the planner
+      */
+     void prepare(const PlannedMove& move, float plannerAcceleration);
+
+     /**
+      * Advances the move by one tick. Meant to be called PROFILE_TICK_RATE
+      * times per second, e.g. from a timer interrupt.
+      *
+      * @return true while the move goes on, false once it is finished
+      */
+     bool tick();
+
+     /**
+      * Distance travelled along the move.
+      *
+      * @return The distance, fixed point (FIXED_POINT_DECIMALS decimals)
+      */
+     int32_t getDistance() const { return distance; }
+
+     /**
+      * Current speed along the move.
+      *
+      * @return The speed, Q16 fixed point units per tick
+      */
+     int32_t getSpeed() const { return speed; }
+
+     /**
+      * Checks whether the move is finished.
+      *
+      * @return true if every tick of the move has been done
+      */
+     bool isFinished() const { return phase >= phaseCount; }
+ };
+
+ #endif
@@ -0,0 +1,40 @@
+/**
+ * MotionQueue.cpp - Queue of pending moves for the COXIRIS Positioning System
+ *                   command parser.
+ *
+ * It sits between the parser and the motion executor, so the host can keep
+ * several moves in flight instead of waiting a full round trip between them.
+ */
+
+ #include "MotionQueue.h"
+
+ #define MOTION_QUEUE_MASK (MOTION_QUEUE_DEPTH - 1)
+
+ /**
+  * Adds a move at the back of the queue.
+  */
+ bool MotionQueue::push(const MotionCommand& move) {
+   if (count == MOTION_QUEUE_DEPTH) {
+     return false;
+   }
+   entries[(head + count) & MOTION_QUEUE_MASK] = move;
+   count++;
+   return true;
+ }
+
+ /**
+  * Returns a queued move, e.g. for the planner to look ahead.
+  */
+ const MotionCommand* MotionQueue::at(uint8_t index) const {
+   return index < count ? &entries[(head + index) & MOTION_QUEUE_MASK] : nullptr;
+ }
+
+ /**
+  * Removes the oldest move.
+  */
+ void MotionQueue::pop() {
+   if (count > 0) {
+     head = (head + 1) & MOTION_QUEUE_MASK;
+     count--;
+   }
+ }
@@ -0,0 +1,105 @@
+/**
+ * MotionQueue.h - Queue of pending moves for the COXIRIS Positioning System
+ *                 command parser.
+ *
+ * It sits between the parser and the motion executor, so the host can keep
+ * several moves in flight instead of waiting a full round trip between them.
+ */
+
+ #ifndef MOTION_QUEUE_H
+ #define MOTION_QUEUE_H
+
+ #include <Arduino.h>
+ #include "CommandStats.h"
+
+ #ifndef MOTION_QUEUE_DEPTH
+ #define MOTION_QUEUE_DEPTH 8  // Moves that can wait for the executor (power of two)
+ #endif
+ #define MOTION_AXES 3         // Values carried by each move (x, y, z)
+
+ static_assert((MOTION_QUEUE_DEPTH & (MOTION_QUEUE_DEPTH - 1)) == 0 && MOTION_QUEUE_DEPTH <= 128,
+               "MOTION_QUEUE_DEPTH must be a power of two up to 128");
+
+ // Flags of a queued move, telling finishMove() what to reply
+ enum MotionFlags : uint8_t {
+   MOTION_PATH_POINT = 0x01,  // Point of a PATH batch, only the last one sends DONE
+   MOTION_PATH_LAST = 0x02,   // Last point of its batch, finishing it sends DONE PATH
+   MOTION_REPORT = 0x04       // Finishing the point sends a POINT reply with its index
+ };
+
+ // Move waiting for the motion executor
+ struct MotionCommand {
+   uint8_t command;              // CommandParser::CommandId of the move (CMD_ABSOLUTE_MOVE...), PATH
+                                 // points are queued as CMD_ABSOLUTE_MOVE
+   uint16_t tag;                 // Tag of the command, echoed with its DONE (COMMAND_NO_TAG if none)
+   int32_t values[MOTION_AXES];  // Target or offset, fixed point (FIXED_POINT_DECIMALS decimals)
+   uint8_t flags;                // MotionFlags, 0 for a single move
+   uint8_t point;                // Index of the point in its PATH batch
+ #if COMMAND_PARSER_STATS
+   unsigned long dispatched;     // micros() of the ACK, timed again at the DONE
+ #endif
+ };
+
+ /**
+  * MotionQueue class - Statically allocated FIFO of moves
+  *
+  * The parser pushes the moves it receives, the executor works on front() and
+  * pops it once the move is finished, so the move being executed still takes
+  * its slot until its DONE is sent.
+  */
+ class MotionQueue {
+   private:
+     MotionCommand entries[MOTION_QUEUE_DEPTH];
+     uint8_t head = 0;   // Index of the oldest move
+     uint8_t count = 0;  // Moves in the queue
+
+   public:
+     /**
+      * Adds a move at the back of the queue.
+      *
+      * @param move The move
+      * @return true if it was added, false if the queue is full
+      */
+     bool push(const MotionCommand& move);
+
+     /**
+      * Returns the oldest move, the one the executor should run.
+      *
+      * @return The move, or nullptr if the queue is empty
+      */
+     const MotionCommand* front() const { return count > 0 ? &entries[head] : nullptr; }
+
+     /**
+      * Returns a queued move, e.g. for the planner to look ahead.
+      *
+      * @param index Position in the queue, 0 for the oldest move
+      * @return The move, or nullptr if there are not that many moves
+      */
+     const MotionCommand* at(uint8_t index) const;
+
+     /**
+      * Removes the oldest move.
+      */
+     void pop();
+
+     /**
+      * Removes every move.
+      */
+     void clear() { head = count = 0; }
+
+     /**
+      * Number of moves in the queue, including the one being executed.
+      *
+      * @return The number of moves
+      */
+     uint8_t size() const { return count; }
+
+     /**
+      * Number of moves that can still be queued.
+      *
+      * @return The free slots
+      */
+     uint8_t free() const { return MOTION_QUEUE_DEPTH - count; }
+ };
+
+ #endif
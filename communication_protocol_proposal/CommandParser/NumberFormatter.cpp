@@ -0,0 +1,112 @@
+/**
+ * NumberFormatter.cpp - Number to text conversion for the COXIRIS Positioning
+ *                       System command parser.
+ *
+ * It renders numbers straight into a caller provided buffer, so a complete
+ * response can be built on the stack and sent with a single write.
+ */
+
+ #include "NumberFormatter.h"
+
+ // Powers of ten subtracted to extract each digit, most significant first
+ static const uint32_t DIGIT_POWERS[] = {
+   1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+   10000UL, 1000UL, 100UL, 10UL, 1UL
+ };
+
+ // Half of the last dropped digit, indexed by the number of dropped decimals
+ static const uint16_t ROUNDING_HALVES[] = { 0, 5, 50, 500 };
+
+ // Scale applied to a float before rounding, indexed by the number of decimals
+ static const float FLOAT_SCALES[] = { 1.0f, 10.0f, 100.0f, 1000.0f };
+
+ /**
+  * Helper function to write the decimal digits of a value.
+  * Each digit costs at most nine subtractions, there is no division.
+  *
+  * @param buffer Where the digits are written
+  * @param value The value
+  * @param minDigits Minimum number of digits, padded with leading zeros
+  * @return Number of digits written
+  */
+ static uint8_t writeDigits(char* buffer, uint32_t value, uint8_t minDigits) {
+   uint8_t count = 0;
+   for (uint8_t i = 0; i < 10; i++) {
+     uint32_t power = DIGIT_POWERS[i];
+     char digit = '0';
+     while (value >= power) {
+       value -= power;
+       digit++;
+     }
+     if (count > 0 || digit != '0' || i >= 10 - minDigits) {
+       buffer[count++] = digit;
+     }
+   }
+   return count;
+ }
+
+ /**
+  * Formats a fixed point integer, rounding to the requested decimals
+  * (halves away from zero).
+  */
+ uint8_t NumberFormatter::formatFixed(char* buffer, int32_t value, uint8_t valueDecimals, uint8_t decimals) {
+   if (decimals > valueDecimals) {
+     decimals = valueDecimals;
+   }
+   uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+   magnitude += ROUNDING_HALVES[valueDecimals - decimals];
+
+   // All the digits, with at least one before the decimal point
+   char digits[10];
+   uint8_t count = writeDigits(digits, magnitude, valueDecimals + 1);
+   uint8_t integerDigits = count - valueDecimals;
+   uint8_t printed = integerDigits + decimals;
+
+   // Only print the sign if a non zero digit is printed
+   uint8_t length = 0;
+   if (value < 0) {
+     for (uint8_t i = 0; i < printed; i++) {
+       if (digits[i] != '0') {
+         buffer[length++] = '-';
+         break;
+       }
+     }
+   }
+   memcpy(buffer + length, digits, integerDigits);
+   length += integerDigits;
+   if (decimals > 0) {
+     buffer[length++] = '.';
+     memcpy(buffer + length, digits + integerDigits, decimals);
+     length += decimals;
+   }
+   return length;
+ }
+
+ /**
+  * Formats an unsigned integer.
+  */
+ uint8_t NumberFormatter::formatUnsigned(char* buffer, uint32_t value) {
+   return writeDigits(buffer, value, 1);
+ }
+
+ /**
+  * Formats a float with the requested decimals.
+  * The value is scaled and rounded once, the rest is integer formatting.
+  */
+ uint8_t NumberFormatter::formatFloat(char* buffer, float value, uint8_t decimals) {
+   if (decimals > 3) {
+     decimals = 3;
+   }
+   if (isnan(value)) {
+     memcpy(buffer, "nan", 3);
+     return 3;
+   }
+   float scaled = value * FLOAT_SCALES[decimals];
+   // 2147483647 rounds to 2^31 as a float, so the limits are written as 2^31
+   if (scaled >= 2147483648.0f || scaled <= -2147483648.0f) {
+     memcpy(buffer, "ovf", 3);
+     return 3;
+   }
+   int32_t rounded = (int32_t)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+   return formatFixed(buffer, rounded, decimals, decimals);
+ }
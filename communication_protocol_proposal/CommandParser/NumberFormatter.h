@@ -0,0 +1,57 @@
+/**
+ * NumberFormatter.h - Number to text conversion for the COXIRIS Positioning
+ *                     System command parser.
+ *
+ * It renders numbers straight into a caller provided buffer, so a complete
+ * response can be built on the stack and sent with a single write.
+ */
+
+ #ifndef NUMBER_FORMATTER_H
+ #define NUMBER_FORMATTER_H
+
+ #include <Arduino.h>
+
+ #define NUMBER_FORMAT_SIZE 16  // Longest formatted number ("-2147483648.000" plus one)
+
+ /**
+  * NumberFormatter class - Fast decimal formatting of numbers
+  *
+  * Digits are extracted by subtracting powers of ten instead of dividing, which
+  * avoids the 32-bit division loops of Print::printNumber()/printFloat() on
+  * 8-bit MCUs. Floats are scaled and rounded once, then printed as integers.
+  */
+ class NumberFormatter {
+   public:
+     /**
+      * Formats a fixed point integer, rounding to the requested decimals.
+      *
+      * @param buffer Where the text is written, at least NUMBER_FORMAT_SIZE bytes
+      * @param value The fixed point value
+      * @param valueDecimals Number of decimals of the value (3 for thousandths)
+      * @param decimals Number of decimals to print, at most valueDecimals
+      * @return Number of characters written (no null terminator)
+      */
+     static uint8_t formatFixed(char* buffer, int32_t value, uint8_t valueDecimals, uint8_t decimals);
+
+     /**
+      * Formats an unsigned integer.
+      *
+      * @param buffer Where the text is written, at least NUMBER_FORMAT_SIZE bytes
+      * @param value The value
+      * @return Number of characters written (no null terminator)
+      */
+     static uint8_t formatUnsigned(char* buffer, uint32_t value);
+
+     /**
+      * Formats a float with the requested decimals. Values that do not fit in
+      * an int32_t once scaled are written as "ovf", like Print::printFloat().
+      *
+      * @param buffer Where the text is written, at least NUMBER_FORMAT_SIZE bytes
+      * @param value The value
+      * @param decimals Number of decimals to print (0-3)
+      * @return Number of characters written (no null terminator)
+      */
+     static uint8_t formatFloat(char* buffer, float value, uint8_t decimals);
+ };
+
+ #endif
@@ -0,0 +1,277 @@
+/**
+ * NumberParser.cpp - Single pass number parser for the COXIRIS Positioning System
+ *                    command parser.
+ *
+ * It validates and converts a decimal number while its characters arrive, one
+ * call per character, without going through atof()/strtod() and without
+ * depending on the locale.
+ */
+
+ #include "NumberParser.h"
+
+ // Powers of ten 10^(2^i), used to build any power of ten with a few products
+ static const float BINARY_POWERS_OF_TEN[] = {
+   1e1f, 1e2f, 1e4f, 1e8f, 1e16f, 1e32f
+ };
+
+ // Leading NUMBER_MAX_DIGITS digits of the largest float, 3.4028235e38
+ static const int32_t FLOAT_MAX_DIGITS = 340282350;
+
+ /**
+  * Clears the parser to start a new number.
+  */
+ void NumberParser::reset() {
+   mantissa = 0;
+   scale = 0;
+   exponent = 0;
+   digits = 0;
+   length = 0;
+   state = STATE_START;
+   status = NUMBER_OK;
+   errorPosition = 0;
+   negative = false;
+   negativeExponent = false;
+ }
+
+ /**
+  * Helper function to record an error at the current character.
+  * Only the first error is kept, the rest of the number is ignored.
+  *
+  * @param error The error status
+  */
+ void NumberParser::fail(Status error) {
+   status = error;
+   errorPosition = length;
+   state = STATE_ERROR;
+ }
+
+ /**
+  * Helper function to add a digit to the mantissa.
+  * Only NUMBER_MAX_DIGITS significant digits are kept so the mantissa never
+  * overflows; further integer digits only raise the scale and further fraction
+  * digits are dropped.
+  *
+  * @param digit The digit value (0-9)
+  * @param fraction true if the digit is after the decimal point
+  */
+ void NumberParser::addDigit(uint8_t digit, bool fraction) {
+   if (digits < NUMBER_MAX_DIGITS) {
+     mantissa = mantissa * 10 + digit;
+     if (mantissa != 0) {
+       digits++;  // Leading zeros are not significant
+     }
+     if (fraction) {
+       scale--;
+     }
+   }
+   else if (!fraction) {
+     scale++;
+   }
+ }
+
+ /**
+  * Feeds the next character of the number.
+  *
+  * @param c The character
+  */
+ void NumberParser::feed(char c) {
+   bool isDigit = (c >= '0' && c <= '9');
+   bool isSign = (c == '-' || c == '+');
+
+   switch (state) {
+     case STATE_START:
+       if (isSign) {
+         negative = (c == '-');
+         state = STATE_SIGN;
+         break;
+       }
+       // Fall through - the first character can also be a digit or a point
+     case STATE_SIGN:
+       if (isDigit) {
+         addDigit(c - '0', false);
+         state = STATE_INTEGER;
+       } else if (c == '.') {
+         state = STATE_POINT;
+       } else {
+         fail(NUMBER_UNEXPECTED);
+       }
+       break;
+     case STATE_INTEGER:
+       if (isDigit) {
+         addDigit(c - '0', false);
+       } else if (c == '.') {
+         state = STATE_FRACTION;
+       } else if (c == 'e' || c == 'E') {
+         errorPosition = length;
+         state = STATE_EXPONENT;
+       } else {
+         fail(NUMBER_UNEXPECTED);
+       }
+       break;
+     case STATE_POINT:
+     case STATE_FRACTION:
+       if (isDigit) {
+         addDigit(c - '0', true);
+         state = STATE_FRACTION;
+       } else if ((c == 'e' || c == 'E') && state == STATE_FRACTION) {
+         errorPosition = length;
+         state = STATE_EXPONENT;
+       } else {
+         fail(NUMBER_UNEXPECTED);
+       }
+       break;
+     case STATE_EXPONENT:
+       if (isSign) {
+         negativeExponent = (c == '-');
+         state = STATE_EXPONENT_SIGN;
+         break;
+       }
+       // Fall through - the exponent can start with a digit
+     case STATE_EXPONENT_SIGN:
+     case STATE_EXPONENT_DIGITS:
+       if (isDigit) {
+         if (exponent < 1000) {
+           exponent = exponent * 10 + (c - '0');
+         }
+         state = STATE_EXPONENT_DIGITS;
+       } else {
+         fail(NUMBER_UNEXPECTED);
+       }
+       break;
+     default:
+       break;
+   }
+   if (length < 255) {
+     length++;
+   }
+ }
+
+ /**
+  * Finishes the number and returns the result of the parse.
+  *
+  * @return NUMBER_OK if the number is valid, the error otherwise
+  */
+ NumberParser::Status NumberParser::finish() {
+   switch (state) {
+     case STATE_ERROR:
+       return (Status)status;
+     case STATE_START:
+     case STATE_SIGN:
+     case STATE_POINT:
+       fail(NUMBER_EMPTY);
+       return (Status)status;
+     case STATE_EXPONENT:
+     case STATE_EXPONENT_SIGN:
+       fail(NUMBER_UNEXPECTED);  // Missing exponent digits
+       return (Status)status;
+     default:
+       break;
+   }
+   if (mantissa != 0) {
+     // Decimal exponent of the most significant digit
+     int16_t magnitude = scale + (negativeExponent ? -exponent : exponent) + digits - 1;
+     bool tooLarge = magnitude > NUMBER_MAX_EXPONENT;
+     if (magnitude == NUMBER_MAX_EXPONENT) {
+       // Same magnitude as the largest float, compare the leading digits
+       int32_t leading = mantissa;
+       for (uint8_t i = digits; i < NUMBER_MAX_DIGITS; i++) {
+         leading *= 10;
+       }
+       tooLarge = leading > FLOAT_MAX_DIGITS;
+     }
+     if (tooLarge) {
+       status = NUMBER_OUT_OF_RANGE;  // errorPosition points at the 'e'
+       state = STATE_ERROR;
+     } else if (magnitude < -NUMBER_MAX_EXPONENT) {
+       mantissa = 0;  // Too small for a float, rounds to zero
+     }
+   }
+   return (Status)status;
+ }
+
+ /**
+  * Converts the parsed number to float.
+  * The power of ten is built from BINARY_POWERS_OF_TEN with at most a few
+  * products, and negative powers divide to keep the usual short decimals exact.
+  *
+  * @return The value of the number
+  */
+ float NumberParser::toFloat() const {
+   float value = (float)mantissa;
+   int16_t power = scale + (negativeExponent ? -exponent : exponent);
+   if (value != 0) {
+     // Apply 10^32 steps first so the factor below never overflows
+     while (power >= 32) {
+       value *= BINARY_POWERS_OF_TEN[5];
+       power -= 32;
+     }
+     while (power <= -32) {
+       value /= BINARY_POWERS_OF_TEN[5];
+       power += 32;
+     }
+     uint8_t remaining = power < 0 ? -power : power;
+     float factor = 1;
+     for (uint8_t i = 0; remaining != 0; i++, remaining >>= 1) {
+       if (remaining & 1) {
+         factor *= BINARY_POWERS_OF_TEN[i];
+       }
+     }
+     value = power < 0 ? value / factor : value * factor;
+   }
+   return negative ? -value : value;
+ }
+
+ /**
+  * Converts the parsed number to a fixed point integer, rounding to the
+  * nearest unit (halves away from zero).
+  *
+  * @param decimals Number of decimals of the integer (3 gives thousandths)
+  * @param value Where the value is stored if it fits in an int32_t
+  * @return true if the value fits, false if it is out of range
+  */
+ bool NumberParser::toFixed(uint8_t decimals, int32_t& value) const {
+   int32_t result = mantissa;
+   int16_t power = scale + (negativeExponent ? -exponent : exponent) + decimals;
+   if (result != 0) {
+     if (power < -NUMBER_MAX_DIGITS) {
+       result = 0;  // Smaller than half a unit
+     }
+     else if (power < 0) {
+       // Drop the extra digits, rounding with the last one dropped
+       for (; power < -1; power++) {
+         result /= 10;
+       }
+       result = (result + 5) / 10;
+     }
+     else {
+       for (; power > 0; power--) {
+         if (result > INT32_MAX / 10) {
+           return false;
+         }
+         result *= 10;
+       }
+     }
+   }
+   value = negative ? -result : result;
+   return true;
+ }
+
+ /**
+  * Parses a complete string in one call.
+  *
+  * @param str The characters of the number
+  * @param length The number of characters
+  * @param value Where the value is stored if the number is valid
+  * @return NUMBER_OK if the number is valid, the error otherwise
+  */
+ NumberParser::Status NumberParser::parse(const char* str, size_t length, float& value) {
+   reset();
+   for (size_t i = 0; i < length; i++) {
+     feed(str[i]);
+   }
+   Status result = finish();
+   if (result == NUMBER_OK) {
+     value = toFloat();
+   }
+   return result;
+ }
@@ -0,0 +1,135 @@
+/**
+ * NumberParser.h - Single pass number parser for the COXIRIS Positioning System
+ *                  command parser.
+ *
+ * It validates and converts a decimal number while its characters arrive, one
+ * call per character, without going through atof()/strtod() and without
+ * depending on the locale.
+ */
+
+ #ifndef NUMBER_PARSER_H
+ #define NUMBER_PARSER_H
+
+ #include <Arduino.h>
+
+ #define NUMBER_MAX_DIGITS 9     // Significant digits kept, further digits are truncated
+ #define NUMBER_MAX_EXPONENT 38  // Largest accepted decimal exponent (float range)
+
+ /**
+  * NumberParser class - Incremental parser for decimal numbers
+  *
+  * Accepts an optional sign, digits with at most one decimal point and an
+  * optional exponent ("-12.5", "+3", ".5", "1e-3"). The digits are accumulated
+  * as an integer mantissa and a decimal exponent, so feeding a character costs
+  * a few integer operations and the only float math happens in toFloat().
+  */
+ class NumberParser {
+   public:
+     // Result of the parse
+     enum Status : uint8_t {
+       NUMBER_OK,                  // Valid number
+       NUMBER_EMPTY,               // No digits were received
+       NUMBER_UNEXPECTED,          // A character is not valid at its position
+       NUMBER_OUT_OF_RANGE         // The exponent is outside the float range
+     };
+
+   private:
+     // Position inside the number
+     enum State : uint8_t {
+       STATE_START,                // Nothing received yet
+       STATE_SIGN,                 // After the leading sign
+       STATE_INTEGER,              // Inside the integer digits
+       STATE_POINT,                // After a decimal point with no digits before it
+       STATE_FRACTION,             // Inside the fraction digits
+       STATE_EXPONENT,             // After 'e' or 'E'
+       STATE_EXPONENT_SIGN,        // After the sign of the exponent
+       STATE_EXPONENT_DIGITS,      // Inside the exponent digits
+       STATE_ERROR                 // An error was found, the rest is ignored
+     };
+
+     int32_t mantissa;             // Significant digits, without the decimal point
+     int16_t scale;                // Power of ten applied to the mantissa
+     int16_t exponent;             // Explicit exponent, after 'e'
+     uint8_t digits;               // Significant digits stored in the mantissa
+     uint8_t length;               // Characters received so far
+     uint8_t state;                // State
+     uint8_t status;               // Status, set once an error is found
+     uint8_t errorPosition;        // Index of the offending character
+     bool negative;                // The mantissa is negative
+     bool negativeExponent;        // The exponent is negative
+
+     /**
+      * Helper function to record an error at the current character.
+      *
+      * @param error The error status
+      */
+     void fail(Status error);
+
+     /**
+      * Helper function to add a digit to the mantissa.
+      *
+      * @param digit The digit value (0-9)
+      * @param fraction true if the digit is after the decimal point
+      */
+     void addDigit(uint8_t digit, bool fraction);
+
+   public:
+     NumberParser() { reset(); }
+
+     /**
+      * Clears the parser to start a new number.
+      */
+     void reset();
+
+     /**
+      * Feeds the next character of the number.
+      *
+      * @param c The character
+      */
+     void feed(char c);
+
+     /**
+      * Finishes the number and returns the result of the parse.
+      * Must be called after the last character, before reading the value.
+      *
+      * @return NUMBER_OK if the number is valid, the error otherwise
+      */
+     Status finish();
+
+     /**
+      * Index of the character that made the parse fail. When the number ended
+      * too early (e.g. "1e") it is the length of the number.
+      *
+      * @return The position of the error, only meaningful if finish() failed
+      */
+     uint8_t getErrorPosition() const { return errorPosition; }
+
+     /**
+      * Converts the parsed number to float.
+      *
+      * @return The value of the number
+      */
+     float toFloat() const;
+
+     /**
+      * Converts the parsed number to a fixed point integer, rounding to the
+      * nearest unit. Only integer math is used, so no float code is needed.
+      *
+      * @param decimals Number of decimals of the integer (3 gives thousandths)
+      * @param value Where the value is stored if it fits in an int32_t
+      * @return true if the value fits, false if it is out of range
+      */
+     bool toFixed(uint8_t decimals, int32_t& value) const;
+
+     /**
+      * Parses a complete string in one call.
+      *
+      * @param str The characters of the number
+      * @param length The number of characters
+      * @param value Where the value is stored if the number is valid
+      * @return NUMBER_OK if the number is valid, the error otherwise
+      */
+     Status parse(const char* str, size_t length, float& value);
+ };
+
+ #endif
@@ -0,0 +1,224 @@
+/**
+ * StepEngine.cpp - Interrupt driven step generation for the moves queued by the
+ *                  COXIRIS Positioning System command parser.
+ *
+ * It runs the queued moves from a timer interrupt, so the step timing does
+ * not depend on the main loop nor on the commands being parsed.
+ */
+
+ #include "StepEngine.h"
+
+ #if defined(__AVR__)
+ #include <util/atomic.h>
+ #else
+ // Cores without avr-libc: the block disables the interrupts and enables them
+ // again at its end, there is no portable way to restore their previous state
+ #define ATOMIC_RESTORESTATE
+ #define ATOMIC_BLOCK(type) for (bool atomicOnce = (noInterrupts(), true); atomicOnce; interrupts(), atomicOnce = false)
+ #endif
+
+ #if defined(__AVR__)
+ /**
+  * Starts Timer1 at STEP_TICK_RATE, in CTC mode with a prescaler of 8.
+  */
+ void StepEngine::startTimer() {
+   noInterrupts();
+   TCCR1A = 0;
+   TCCR1B = _BV(WGM12) | _BV(CS11);
+   TCNT1 = 0;
+   OCR1A = F_CPU / 8 / STEP_TICK_RATE - 1;
+   TIMSK1 |= _BV(OCIE1A);
+   interrupts();
+ }
+ #endif
+
+ /**
+  * Helper function to plan the next queued move and load it in the free slot.
+  *
+  * The move is planned from where the last loaded move ends and at its exit
+  * speed, looking ahead over every move queued after it.
+  *
+  * @param queue The motion queue
+  */
+ void StepEngine::load(const MotionQueue& queue) {
+   float unit = 1;
+   for (uint8_t i = 0; i < FIXED_POINT_DECIMALS; i++) {
+     unit *= 10;
+   }
+   planner.plan(queue, loadedTarget, loadedExit, loaded);
+   const PlannedMove* planned = planner.getMove(0);
+   MotionPlanner::advance(*queue.at(loaded), loadedTarget);
+
+   Segment& segment = segments[active ^ 1];
+   segment.total = 0;
+   segment.directions = 0;
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     float exact = loadedTarget[axis] * stepsPerMm[axis] / unit;
+     int32_t steps = (int32_t)(exact + (exact < 0 ? -0.5f : 0.5f));
+     int32_t delta = steps - loadedSteps[axis];
+     if (delta < 0) {
+       segment.directions |= 1 << axis;
+       delta = -delta;
+     }
+     segment.steps[axis] = delta;
+     if ((uint32_t)delta > segment.total) {
+       segment.total = delta;
+     }
+     loadedSteps[axis] = steps;
+   }
+   float length = planned->length * unit;
+   segment.ratio = length > 0 ? (uint32_t)(segment.total / length * 16777216.0f) : 0;
+   // Keeps moved * ratio + fraction within 32 bits in isr()
+   segment.maxMoved = segment.ratio > 0 ? (0xFFFFFFFFUL - 0xFFFFFFUL) / segment.ratio : 0xFFFFFFFFUL;
+   segment.profile.prepare(*planned, planner.getAcceleration());
+   loadedExit = planned->exitSpeed;
+   loaded++;
+
+   // The atomic block also keeps the compiler from moving the writes to the
+   // slot after the flag, and restores the interrupt flag it found
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+     nextReady = true;
+   }
+ }
+
+ /**
+  * Helper function to start running a slot from the interrupt.
+  *
+  * @param slot The slot
+  */
+ void StepEngine::start(uint8_t slot) {
+   active = slot;
+   nextReady = false;
+   running = true;
+   stepped = 0;
+   converted = 0;
+   reached = 0;
+   reachedFraction = 0;
+   pending = 0;
+   spread = 0;
+   subTick = 0;
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     errors[axis] = segments[slot].total / 2;
+   }
+ }
+
+ /**
+  * Loads the queued moves and reports the finished ones.
+  *
+  * @param parser The parser, with useMotionQueue(true)
+  */
+ void StepEngine::update(CommandParserBase& parser) {
+   while (finished > 0 && parser.finishMove()) {
+     ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+       finished--;
+     }
+     loaded--;
+   }
+
+   const MotionQueue& queue = parser.getMotionQueue();
+   if (!nextReady && loaded < queue.size()) {
+     if (!running) {
+       // The axes stopped, even if the last move was planned to go on
+       loadedExit = 0;
+     }
+     load(queue);
+   }
+ }
+
+ /**
+  * Runs one tick of step generation.
+  *
+  * Every STEP_TICKS_PER_PROFILE calls the profile is advanced and the steps
+  * of the main axis it asks for are spread evenly over the next calls, at
+  * most one per call. Steps that did not fit are carried to the next profile
+  * tick, so the engine falls behind instead of losing steps when the profile
+  * is faster than STEP_TICK_RATE.
+  *
+  * Only the distance added since the last profile tick is converted to steps,
+  * with a 32 bit multiply instead of a 64 bit one, which AVR does in software.
+  * The leftover fraction of a step is kept, so the result is the same as
+  * converting the whole distance.
+  */
+ void StepEngine::isr() {
+   if (!running) {
+     if (!nextReady) {
+       return;
+     }
+     start(active ^ 1);
+   }
+   Segment& segment = segments[active];
+
+   if (subTick == 0) {
+     uint32_t target = segment.total;
+     if (segment.profile.tick()) {
+       uint32_t moved = (uint32_t)segment.profile.getDistance() - converted;
+       if (moved > segment.maxMoved) {
+         moved = segment.maxMoved;  // Over 255 steps per profile tick, the rest is carried
+       }
+       converted += moved;
+       reachedFraction += moved * segment.ratio;
+       reached += reachedFraction >> 24;
+       reachedFraction &= 0xFFFFFF;
+       target = reached < segment.total ? reached : segment.total;
+     }
+     pending = target > stepped ? target - stepped : 0;
+     spread = 0;
+   }
+   if (++subTick == STEP_TICKS_PER_PROFILE) {
+     subTick = 0;
+   }
+
+   spread += pending;
+   if (spread >= STEP_TICKS_PER_PROFILE && stepped < segment.total) {
+     spread -= STEP_TICKS_PER_PROFILE;
+     stepped++;
+     uint8_t steps = 0;
+     for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+       errors[axis] += segment.steps[axis];
+       if (errors[axis] >= segment.total) {
+         errors[axis] -= segment.total;
+         steps |= 1 << axis;
+         position[axis] += segment.directions & (1 << axis) ? -1 : 1;
+       }
+     }
+     if (stepCallback != nullptr) {
+       stepCallback(steps, segment.directions);
+     }
+   }
+
+   if (stepped == segment.total && segment.profile.isFinished()) {
+     finished++;
+     running = false;
+     if (nextReady) {
+       start(active ^ 1);
+     }
+   }
+ }
+
+ /**
+  * Returns the position of an axis.
+  *
+  * @param axis The axis, 0 to MOTION_AXES - 1
+  * @return Steps from home
+  */
+ int32_t StepEngine::getSteps(uint8_t axis) const {
+   int32_t steps;
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+     steps = position[axis];
+   }
+   return steps;
+ }
+
+ /**
+  * Makes the current position home. Does nothing while the axes are moving.
+  */
+ void StepEngine::setHome() {
+   if (isMoving()) {
+     return;
+   }
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     position[axis] = 0;
+     loadedTarget[axis] = 0;
+     loadedSteps[axis] = 0;
+   }
+ }
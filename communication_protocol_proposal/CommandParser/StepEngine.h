@@ -0,0 +1,175 @@
+/**
+ * StepEngine.h - Interrupt driven step generation for the moves queued by the
+ *                COXIRIS Positioning System command parser.
+ *
+ * It runs the queued moves from a timer interrupt, so the step timing does
+ * not depend on the main loop nor on the commands being parsed.
+ */
+
+ #ifndef STEP_ENGINE_H
+ #define STEP_ENGINE_H
+
+ #include <Arduino.h>
+ #include "CommandParser.h"
+ #include "MotionPlanner.h"
+ #include "MotionProfile.h"
+
+ #ifndef STEP_TICK_RATE
+ #define STEP_TICK_RATE 10000  // Calls to isr() per second in Hz, the highest step rate of an axis
+ #endif
+ #ifndef STEPS_PER_MM
+ #define STEPS_PER_MM 80.0f    // Default steps per mm of every axis
+ #endif
+ #define STEP_TICKS_PER_PROFILE (STEP_TICK_RATE / PROFILE_TICK_RATE)  // isr() calls per profile tick
+
+ static_assert(STEP_TICK_RATE % PROFILE_TICK_RATE == 0, "STEP_TICK_RATE must be a multiple of PROFILE_TICK_RATE");
+
+ /**
+  * StepEngine class - Bresenham step generation fed from the motion queue
+  *
+  * update(), called from loop(), takes the moves from the motion queue, plans
+  * them and prepares their profile, one move ahead of the one being run so
+  * consecutive moves join without stopping. isr(), called STEP_TICK_RATE
+  * times per second from a timer interrupt, follows the profile of the
+  * current move: the axis with the most steps gets the steps the profile asks
+  * for, spread evenly over the ticks, and the other axes follow it with
+  * Bresenham's algorithm. Once a move is finished update() sends its DONE
+  * with parser.finishMove().
+  *
+  * The interrupt never touches the parser, and the loop only writes the slot
+  * the interrupt is not running, so nothing waits on the other side. update()
+  * must run at least once per move for the moves to join; if it is late the
+  * axes stop at the end of the current move.
+  */
+ class StepEngine {
+   public:
+     /**
+      * Function pointer type for the step output, called from the interrupt
+      * whenever at least one axis steps. Bit n of each mask is axis n (x, y, z).
+      *
+      * @param steps Axes that must step
+      * @param directions Axes that move in the negative direction
+      */
+     typedef void (*StepCallback)(uint8_t steps, uint8_t directions);
+
+   private:
+     // Move loaded for the interrupt
+     struct Segment {
+       MotionProfile profile;
+       uint32_t steps[MOTION_AXES];  // Steps of each axis
+       uint32_t total;               // Steps of the axis with the most steps
+       uint32_t ratio;               // Steps of that axis per unit of distance, Q24
+       uint32_t maxMoved;            // Most units converted to steps per profile tick
+       uint8_t directions;           // Axes that move in the negative direction
+     };
+
+     Segment segments[2];
+     MotionPlanner planner;
+     StepCallback stepCallback = nullptr;
+     float stepsPerMm[MOTION_AXES] = {STEPS_PER_MM, STEPS_PER_MM, STEPS_PER_MM};
+
+     // Shared with the interrupt
+     volatile uint8_t active = 0;      // Slot run by the interrupt
+     volatile bool running = false;    // The interrupt is running the active slot
+     volatile bool nextReady = false;  // The other slot is loaded and waits for the interrupt
+     volatile uint8_t finished = 0;    // Moves finished by the interrupt, not reported yet
+     volatile int32_t position[MOTION_AXES] = {0, 0, 0};  // Steps from home
+
+     // Only used by the interrupt
+     uint32_t stepped = 0;             // Steps of the main axis done in the active slot
+     uint32_t converted = 0;           // Distance of the profile converted to steps, in units
+     uint32_t reached = 0;             // Steps of the main axis that distance takes
+     uint32_t reachedFraction = 0;     // Fraction of a step left over, Q24
+     uint32_t pending = 0;             // Steps of the main axis to do in this profile tick
+     uint32_t spread = 0;              // Accumulator that spreads them over the tick
+     uint32_t errors[MOTION_AXES];     // Bresenham accumulators
+     uint8_t subTick = 0;              // isr() calls since the last profile tick
+
+     // Only used by the loop
+     uint8_t loaded = 0;               // Queued moves loaded and not reported yet
+     int32_t loadedTarget[MOTION_AXES] = {0, 0, 0};  // Where the last loaded move ends, fixed point
+     int32_t loadedSteps[MOTION_AXES] = {0, 0, 0};   // Same in steps
+     float loadedExit = 0;             // Speed at the end of the last loaded move in mm/s
+
+     /**
+      * Helper function to plan the next queued move and load it in the free slot.
+      *
+      * @param queue The motion queue
+      */
+     void load(const MotionQueue& queue);
+
+     /**
+      * Helper function to start running a slot from the interrupt.
+      *
+      * @param slot The slot
+      */
+     void start(uint8_t slot);
+
+   public:
+     /**
+      * Sets the function that outputs the steps.
+      *
+      * @param callback The function
+      */
+     void onStep(StepCallback callback) { stepCallback = callback; }
+
+     /**
+      * Sets the steps per mm of an axis. Only takes effect for moves loaded later.
+      *
+      * @param axis The axis, 0 to MOTION_AXES - 1
+      * @param steps Steps per mm
+      */
+     void setStepsPerMm(uint8_t axis, float steps) { stepsPerMm[axis] = steps; }
+
+     /**
+      * Returns the planner, to set its speed, acceleration and deviation.
+      *
+      * @return The planner
+      */
+     MotionPlanner& getPlanner() { return planner; }
+
+ #if defined(__AVR__)
+     /**
+      * Starts Timer1 at STEP_TICK_RATE. The sketch must call isr() from it:
+      * ISR(TIMER1_COMPA_vect) { engine.isr(); }
+      */
+     void startTimer();
+ #endif
+
+     /**
+      * Loads the queued moves and reports the finished ones. Should be called
+      * from loop(), together with parser.read().
+      *
+      * @param parser The parser, with useMotionQueue(true)
+      */
+     void update(CommandParserBase& parser);
+
+     /**
+      * Runs one tick of step generation. Must be called STEP_TICK_RATE times
+      * per second from a timer interrupt.
+      */
+     void isr();
+
+     /**
+      * Checks whether a move is being run or waits to be run.
+      *
+      * @return true if the axes are moving
+      */
+     bool isMoving() const { return running || nextReady; }
+
+     /**
+      * Returns the position of an axis, e.g. for the GET_POSITION callback.
+      *
+      * @param axis The axis, 0 to MOTION_AXES - 1
+      * @return Steps from home
+      */
+     int32_t getSteps(uint8_t axis) const;
+
+     /**
+      * Makes the current position home, e.g. from the SET_HOME callback. Does
+      * nothing while the axes are moving.
+      */
+     void setHome();
+ };
+
+ #endif
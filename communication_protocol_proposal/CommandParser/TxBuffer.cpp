@@ -0,0 +1,88 @@
+/**
+ * TxBuffer.cpp - Transmit ring buffer for the COXIRIS Positioning System
+ *                command parser.
+ *
+ * It holds the parser output until the serial port can take it, so writing a
+ * response never waits for the UART.
+ */
+
+ #include "TxBuffer.h"
+
+ #define TX_BUFFER_MASK (TX_BUFFER_SIZE - 1)
+
+ /**
+  * Copies bytes into the ring, applying the overflow policy if they do not fit.
+  */
+ bool TxBuffer::write(const char* bytes, size_t length) {
+   if (length > (size_t)(TX_BUFFER_SIZE - count)) {
+     stats.overflows++;
+     if (policy == OVERFLOW_BLOCK && port != nullptr && length <= TX_BUFFER_SIZE) {
+       send(length - (TX_BUFFER_SIZE - count));  // Blocks until there is room
+     } else {
+       stats.droppedBytes += length;
+       return false;
+     }
+   }
+   // Copy in at most two spans, before and after the end of the array
+   size_t first = TX_BUFFER_SIZE - head;
+   if (first > length) {
+     first = length;
+   }
+   memcpy(data + head, bytes, first);
+   memcpy(data, bytes + first, length - first);
+   head = (head + length) & TX_BUFFER_MASK;
+   count += length;
+   if (count > stats.highWater) {
+     stats.highWater = count;
+   }
+   return true;
+ }
+
+ /**
+  * Helper function to send up to a number of bytes from the tail.
+  * Writes contiguous spans, so a full ring costs at most two port writes.
+  *
+  * @param limit Maximum number of bytes to send
+  */
+ void TxBuffer::send(uint16_t limit) {
+   if (limit > count) {
+     limit = count;
+   }
+   while (limit > 0) {
+     uint16_t span = TX_BUFFER_SIZE - tail;
+     if (span > limit) {
+       span = limit;
+     }
+     port->write(data + tail, span);
+     tail = (tail + span) & TX_BUFFER_MASK;
+     count -= span;
+     limit -= span;
+   }
+ }
+
+ /**
+  * Sends as many bytes as the port can take without blocking.
+  * With OVERFLOW_BLOCK everything is sent, as the port did before the ring.
+  */
+ void TxBuffer::drain() {
+   if (port == nullptr || count == 0) {
+     return;
+   }
+   if (policy == OVERFLOW_BLOCK) {
+     send(count);
+     return;
+   }
+   int room = port->availableForWrite();
+   if (room > 0) {
+     send(room);
+   }
+ }
+
+ /**
+  * Sends every byte in the ring, blocking until the port takes them.
+  */
+ void TxBuffer::flush() {
+   if (port != nullptr) {
+     send(count);
+   }
+ }
@@ -0,0 +1,132 @@
+/**
+ * TxBuffer.h - Transmit ring buffer for the COXIRIS Positioning System
+ *              command parser.
+ *
+ * It holds the parser output until the serial port can take it, so writing a
+ * response never waits for the UART.
+ */
+
+ #ifndef TX_BUFFER_H
+ #define TX_BUFFER_H
+
+ #include <Arduino.h>
+
+ #ifndef TX_BUFFER_SIZE
+ #define TX_BUFFER_SIZE 256  // Transmit ring size in bytes (power of two)
+ #endif
+
+ static_assert((TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) == 0, "TX_BUFFER_SIZE must be a power of two");
+
+ /**
+  * TxBuffer class - Bounded ring between the parser and the serial port
+  *
+  * write() only copies into the ring. drain() moves as many bytes as the port
+  * reports with availableForWrite(), so it never blocks. When a write does not
+  * fit it is dropped and counted. OVERFLOW_BLOCK instead keeps the old
+  * behaviour: the ring is flushed to the port, waiting for it, whenever needed.
+  */
+ class TxBuffer {
+   public:
+     // What write() does when the data does not fit
+     enum OverflowPolicy : uint8_t {
+       OVERFLOW_DROP,   // Drop the whole write and count it
+       OVERFLOW_BLOCK   // Wait for the port to make room (the old blocking behaviour)
+     };
+
+     // Counters, kept since begin() or resetStats()
+     struct Stats {
+       uint32_t droppedBytes;  // Bytes dropped by OVERFLOW_DROP
+       uint16_t overflows;     // Writes that did not fit
+       uint16_t highWater;     // Largest number of bytes waiting in the ring
+     };
+
+   private:
+     Print* port = nullptr;        // Where the bytes are drained to
+     uint8_t data[TX_BUFFER_SIZE];
+     uint16_t head = 0;            // Index of the next byte to write
+     uint16_t tail = 0;            // Index of the next byte to send
+     uint16_t count = 0;           // Bytes waiting in the ring
+     uint8_t policy = OVERFLOW_DROP;
+     Stats stats = {};
+
+     /**
+      * Helper function to send up to a number of bytes from the tail.
+      *
+      * @param limit Maximum number of bytes to send
+      */
+     void send(uint16_t limit);
+
+   public:
+     /**
+      * Sets the port the ring is drained to.
+      *
+      * @param output The serial port
+      */
+     void begin(Print& output) { port = &output; }
+
+     /**
+      * Sets what happens when a write does not fit.
+      *
+      * @param overflowPolicy OVERFLOW_DROP or OVERFLOW_BLOCK
+      */
+     void setOverflowPolicy(OverflowPolicy overflowPolicy) { policy = overflowPolicy; }
+
+     /**
+      * Copies bytes into the ring. The bytes of one call are either all
+      * queued or, with OVERFLOW_DROP, all dropped.
+      *
+      * @param bytes The bytes to send
+      * @param length Number of bytes
+      * @return true if the bytes were queued, false if they were dropped
+      */
+     bool write(const char* bytes, size_t length);
+
+     /**
+      * Sends as many bytes as the port can take without blocking, or every
+      * byte with OVERFLOW_BLOCK. Should be called often, e.g. from
+      * CommandParser::read().
+      */
+     void drain();
+
+     /**
+      * Sends every byte in the ring, blocking until the port takes them.
+      */
+     void flush();
+
+     /**
+      * Number of bytes that can be written without overflowing.
+      *
+      * @return The free space in bytes
+      */
+     uint16_t available() const { return TX_BUFFER_SIZE - count; }
+
+     /**
+      * Checks if a write of the given length can be made now without being
+      * dropped. With OVERFLOW_BLOCK every write fits, since it waits for room.
+      *
+      * @param length Number of bytes
+      * @return true if the write would be queued
+      */
+     bool fits(uint16_t length) const { return policy == OVERFLOW_BLOCK || length <= available(); }
+
+     /**
+      * Number of bytes waiting to be sent.
+      *
+      * @return The used space in bytes
+      */
+     uint16_t pending() const { return count; }
+
+     /**
+      * Returns the overflow counters.
+      *
+      * @return The counters
+      */
+     const Stats& getStats() const { return stats; }
+
+     /**
+      * Clears the overflow counters.
+      */
+     void resetStats() { stats = Stats(); }
+ };
+
+ #endif
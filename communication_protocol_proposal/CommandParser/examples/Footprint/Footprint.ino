@@ -0,0 +1,84 @@
+/**
+ * Footprint.ino - Reference sketch for the flash and SRAM footprint of the
+ *                 COXIRIS Positioning System command parser.
+ *
+ * It registers a callback for every command that takes one, with the queued
+ * moves run by StepEngine, so the whole library is linked. The callbacks use
+ * fixed point integers, so the same sketch also builds with
+ * COMMAND_PARSER_FIXED_POINT=1. Build it for an Arduino Uno and read the
+ * sizes with avr-size, e.g.
+ *
+ *   arduino-cli compile -b arduino:avr:uno --library ../.. --output-dir build .
+ *   avr-size -C --mcu=atmega328p build/Footprint.ino.elf
+ *
+ * and once more adding
+ *   --build-property "compiler.cpp.extra_flags=-DCOMMAND_PARSER_STATS=1 -DCOMMAND_PARSER_FIXED_POINT=1"
+ */
+
+ #include <CommandParser.h>
+ #include <StepEngine.h>
+
+ CommandParser parser;
+ StepEngine engine;
+ int32_t speed = 10000;  // µm/s
+
+ ISR(TIMER1_COMPA_vect) {
+   engine.isr();
+ }
+
+ void step(uint8_t steps, uint8_t directions) {
+   PORTD = (PORTD & 0x1F) | directions << 5;  // Direction pins 5 to 7
+   PORTB |= steps;                             // Step pins 8 to 10
+   PORTB &= ~steps;
+ }
+
+ void setHome() {
+   engine.setHome();
+ }
+
+ void getPosition(int32_t &x, int32_t &y, int32_t &z) {
+   x = (int32_t)(engine.getSteps(0) * 1000 / STEPS_PER_MM);
+   y = (int32_t)(engine.getSteps(1) * 1000 / STEPS_PER_MM);
+   z = (int32_t)(engine.getSteps(2) * 1000 / STEPS_PER_MM);
+ }
+
+ void setSpeed(int32_t &value) {
+   speed = value;
+   engine.getPlanner().setSpeed(value / 1000.0f);
+ }
+
+ void getSpeed(int32_t &value) {
+   value = speed;
+ }
+
+ void getMinSpeed(int32_t &value) {
+   value = 1;
+ }
+
+ void getMaxSpeed(int32_t &value) {
+   value = 100000;
+ }
+
+ void checkErrors() {
+ }
+
+ void setup() {
+   DDRD |= 0xE0;
+   DDRB |= 0x07;
+   parser.begin();
+   parser.useMotionQueue(true);
+   parser.on(CommandParser::CMD_SET_HOME, setHome);
+   parser.on(CommandParser::CMD_CHECK_ERRORS, checkErrors);
+   parser.on(CommandParser::CMD_GET_POSITION, getPosition);
+   parser.on(CommandParser::CMD_SET_SPEED, setSpeed);
+   parser.on(CommandParser::CMD_GET_SPEED, getSpeed);
+   parser.on(CommandParser::CMD_GET_MIN_SPEED, getMinSpeed);
+   parser.on(CommandParser::CMD_GET_MAX_SPEED, getMaxSpeed);
+   engine.onStep(step);
+   engine.startTimer();
+ }
+
+ void loop() {
+   parser.read();
+   engine.update(parser);
+ }
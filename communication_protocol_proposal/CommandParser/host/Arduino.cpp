@@ -0,0 +1,47 @@
+/**
+ * Arduino.cpp - Minimal Arduino core for building the COXIRIS Positioning System
+ *               command parser on a host (Linux) machine.
+ *
+ * It only provides what the library uses. Serial takes its input from the
+ * host program and keeps its output for it, and the clock only advances when
+ * the host program says so, so every run is reproducible.
+ */
+
+ #include "Arduino.h"
+
+ HardwareSerial Serial;
+
+ static unsigned long clockMicros = 0;
+
+ unsigned long micros() {
+   return clockMicros;
+ }
+
+ unsigned long millis() {
+   return clockMicros / 1000;
+ }
+
+ /**
+  * Advances the clock seen by micros() and millis().
+  */
+ void hostAdvanceMicros(unsigned long microseconds) {
+   clockMicros += microseconds;
+ }
+
+ /**
+  * Adds bytes to the input, after the ones not read yet.
+  */
+ void HardwareSerial::inject(const void* bytes, size_t count) {
+   input.erase(0, inputPosition);
+   inputPosition = 0;
+   input.append((const char*)bytes, count);
+ }
+
+ /**
+  * Returns the bytes written since the last call and forgets them.
+  */
+ std::string HardwareSerial::takeOutput() {
+   std::string taken;
+   taken.swap(output);
+   return taken;
+ }
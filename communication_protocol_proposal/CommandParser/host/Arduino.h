@@ -0,0 +1,155 @@
+/**
+ * Arduino.h - Minimal Arduino core for building the COXIRIS Positioning System
+ *             command parser on a host (Linux) machine.
+ *
+ * It only provides what the library uses. Serial takes its input from the
+ * host program and keeps its output for it, and the clock only advances when
+ * the host program says so, so every run is reproducible.
+ */
+
+ #ifndef ARDUINO_HOST_H
+ #define ARDUINO_HOST_H
+
+ #include <ctype.h>
+ #include <math.h>
+ #include <stddef.h>
+ #include <stdint.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <string>
+
+ // Program memory is ordinary memory on the host
+ #define PROGMEM
+ #define PGM_P const char*
+ #define memcpy_P memcpy
+ #define memcmp_P memcmp
+ #define strlen_P strlen
+ #define _BV(bit) (1 << (bit))
+
+ class __FlashStringHelper;
+ #define F(string) (reinterpret_cast<const __FlashStringHelper*>(string))
+
+ inline uint8_t pgm_read_byte(const void* address) { return *(const uint8_t*)address; }
+ inline uint16_t pgm_read_word(const void* address) { return *(const uint16_t*)address; }
+ inline uint32_t pgm_read_dword(const void* address) { return *(const uint32_t*)address; }
+ inline const void* pgm_read_ptr(const void* address) { return *(const void* const*)address; }
+
+ // There are no interrupts on the host, isr() is called by the host program
+ inline void noInterrupts() {}
+ inline void interrupts() {}
+
+ /**
+  * Time since the program started. Only advances with hostAdvanceMicros().
+  */
+ unsigned long micros();
+ unsigned long millis();
+
+ /**
+  * Advances the clock seen by micros() and millis().
+  *
+  * @param microseconds Time to advance
+  */
+ void hostAdvanceMicros(unsigned long microseconds);
+
+ /**
+  * Print class - Byte output
+  */
+ class Print {
+   public:
+     virtual ~Print() {}
+     virtual size_t write(uint8_t byte) = 0;
+     virtual size_t write(const uint8_t* bytes, size_t count) {
+       for (size_t i = 0; i < count; i++) {
+         write(bytes[i]);
+       }
+       return count;
+     }
+     size_t write(const char* bytes, size_t count) { return write((const uint8_t*)bytes, count); }
+     virtual int availableForWrite() { return 0; }
+ };
+
+ /**
+  * Stream class - Byte input and output
+  */
+ class Stream : public Print {
+   public:
+     virtual int available() = 0;
+     virtual int read() = 0;
+     virtual int peek() = 0;
+     void setTimeout(unsigned long) {}
+ };
+
+ /**
+  * HardwareSerial class - Serial port fed and read by the host program
+  *
+  * Bytes given to inject() are returned by read(), and every byte written is
+  * kept until takeOutput() is called. availableForWrite() reports a fixed
+  * room, by default a UART FIFO that is always empty; setWriteRoom() allows
+  * simulating a slow link.
+  */
+ class HardwareSerial : public Stream {
+   private:
+     std::string input;
+     size_t inputPosition = 0;
+     std::string output;
+     int writeRoom = 64;
+     unsigned long baudRate = 0;
+
+   public:
+     void begin(unsigned long rate) { baudRate = rate; }
+     void end() {}
+     void flush() {}
+     int available() override { return (int)(input.size() - inputPosition); }
+     int read() override { return inputPosition < input.size() ? (uint8_t)input[inputPosition++] : -1; }
+     int peek() override { return inputPosition < input.size() ? (uint8_t)input[inputPosition] : -1; }
+     int availableForWrite() override { return writeRoom; }
+     size_t write(uint8_t byte) override {
+       output += (char)byte;
+       return 1;
+     }
+     size_t write(const uint8_t* bytes, size_t count) override {
+       output.append((const char*)bytes, count);
+       return count;
+     }
+     using Print::write;
+
+     /**
+      * Adds bytes to the input, after the ones not read yet.
+      *
+      * @param bytes The bytes
+      * @param count Number of bytes
+      */
+     void inject(const void* bytes, size_t count);
+
+     /**
+      * Adds a string to the input, after the bytes not read yet.
+      *
+      * @param text The string
+      */
+     void inject(const char* text) { inject(text, strlen(text)); }
+
+     /**
+      * Returns the bytes written since the last call and forgets them.
+      *
+      * @return The bytes
+      */
+     std::string takeOutput();
+
+     /**
+      * Sets what availableForWrite() reports.
+      *
+      * @param room Bytes the port accepts without blocking
+      */
+     void setWriteRoom(int room) { writeRoom = room; }
+
+     /**
+      * Returns the rate of the last begin().
+      *
+      * @return The baud rate
+      */
+     unsigned long getBaudRate() const { return baudRate; }
+ };
+
+ extern HardwareSerial Serial;
+
+ #endif
@@ -0,0 +1,71 @@
+/**
+ * Benchmark.h - Timing helpers for the host benchmarks of the COXIRIS
+ *               Positioning System command parser.
+ *
+ * Each benchmark runs a function until at least BENCHMARK_MIN_TIME has passed
+ * and reports the mean time per call and the calls per second.
+ */
+
+ #ifndef BENCHMARK_H
+ #define BENCHMARK_H
+
+ #include <stdint.h>
+ #include <stdio.h>
+ #include <string.h>
+ #include <chrono>
+
+ #ifndef BENCHMARK_MIN_TIME
+ #define BENCHMARK_MIN_TIME 0.2  // Seconds each benchmark runs at least
+ #endif
+ #define BENCHMARK_NAME_WIDTH 42  // Names that are longer get a line of their own
+
+ // Written by the benchmarks so the compiler cannot drop the work being timed
+ static volatile uint32_t benchmarkSink;
+
+ /**
+  * Runs a function repeatedly and returns its mean time. The number of calls
+  * is doubled until the run takes at least BENCHMARK_MIN_TIME.
+  *
+  * @param function The function, called with no arguments
+  * @param operations Operations done by each call, e.g. commands per batch
+  * @return Nanoseconds per operation
+  */
+ template <typename Function>
+ double measure(Function function, double operations = 1) {
+   function();  // Warm up caches and lazy state
+   for (unsigned long calls = 1;; calls *= 2) {
+     std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+     for (unsigned long i = 0; i < calls; i++) {
+       function();
+     }
+     double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+     if (seconds >= BENCHMARK_MIN_TIME) {
+       return seconds * 1e9 / (calls * operations);
+     }
+   }
+ }
+
+ /**
+  * Prints a section title.
+  *
+  * @param title The title
+  */
+ inline void reportSection(const char* title) {
+   printf("\n%s\n  %-*s %12s %14s\n", title, BENCHMARK_NAME_WIDTH, "", "ns/op", "op/s");
+ }
+
+ /**
+  * Prints the result of a benchmark.
+  *
+  * @param name What was measured
+  * @param nanoseconds Nanoseconds per operation
+  */
+ inline void report(const char* name, double nanoseconds) {
+   if (strlen(name) > BENCHMARK_NAME_WIDTH) {
+     printf("  %s\n", name);
+     name = "";
+   }
+   printf("  %-*s %12.1f %14.0f\n", BENCHMARK_NAME_WIDTH, name, nanoseconds, 1e9 / nanoseconds);
+ }
+
+ #endif
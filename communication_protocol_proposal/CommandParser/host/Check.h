@@ -0,0 +1,49 @@
+/**
+ * Check.h - Checks for the host tests of the COXIRIS Positioning System
+ *           command parser.
+ *
+ * Each failed check prints the expression with its file and line, and the
+ * test program fails if any check did, so ctest reports it.
+ */
+
+ #ifndef CHECK_H
+ #define CHECK_H
+
+ #include <stdio.h>
+ #include <string.h>
+
+ // Failed checks of the test program
+ static int checkFailures = 0;
+
+ #define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+ /**
+  * Helper function to count and report a failed check.
+  *
+  * @param passed Result of the check
+  * @param expression The checked expression
+  * @param file File of the check
+  * @param line Line of the check
+  */
+ inline void check(bool passed, const char* expression, const char* file, int line) {
+   if (!passed) {
+     const char* name = strrchr(file, '/');
+     printf("%s:%d: CHECK(%s) failed\n", name != nullptr ? name + 1 : file, line, expression);
+     checkFailures++;
+   }
+ }
+
+ /**
+  * Reports the failed checks, called at the end of main().
+  *
+  * @return The exit status of the test program, 1 if a check failed
+  */
+ inline int checkResult() {
+   if (checkFailures > 0) {
+     printf("%d checks failed\n", checkFailures);
+     return 1;
+   }
+   return 0;
+ }
+
+ #endif
@@ -0,0 +1,155 @@
+/**
+ * MotionBenchmark.cpp - Host benchmarks of the motion modules of the COXIRIS
+ *                       Positioning System command parser.
+ *
+ * It times the planner, a profile tick and a step interrupt, and compares the
+ * mean cost of the step interrupt at increasing speeds with the time between
+ * two of its calls.
+ */
+
+ #include "Benchmark.h"
+ #include "CommandParser.h"
+ #include "StepEngine.h"
+
+ CommandParser parser;
+
+ static uint32_t stepCount = 0;
+
+ void countSteps(uint8_t steps, uint8_t /* directions */) {
+   stepCount += steps & 1;
+ }
+
+ /**
+  * Helper function to queue a move through the parser.
+  *
+  * @param line The command, with its line ending
+  */
+ static void queueMove(const char* line) {
+   Serial.inject(line);
+   parser.read();
+   Serial.takeOutput();
+ }
+
+ /**
+  * Times the planner, the profile and the step interrupt.
+  */
+ static void benchmarkModules() {
+   reportSection("Modules");
+
+   for (uint8_t i = 0; i < MOTION_QUEUE_DEPTH; i++) {
+     queueMove(i % 2 ? "DELTA_MOVE 1 0.5 0\n" : "DELTA_MOVE 0.5 1 0\n");
+   }
+   MotionPlanner planner;
+   int32_t start[MOTION_AXES] = {0, 0, 0};
+   report("planner: plan a full queue", measure([&]() {
+     planner.plan(parser.getMotionQueue(), start, 0);
+     benchmarkSink = (uint32_t)planner.getMove(0)->exitSpeed;
+   }));
+   while (parser.finishMove()) {
+   }
+   Serial.takeOutput();
+
+   PlannedMove longMove = {1000, 0, 10, 0};
+   MotionProfile profile;
+   report("profile: prepare", measure([&]() {
+     profile.prepare(longMove, 500);
+     benchmarkSink = profile.isFinished();
+   }));
+   MotionProfile::Shape shapes[] = {MotionProfile::PROFILE_TRAPEZOID, MotionProfile::PROFILE_S_CURVE};
+   const char* names[] = {"profile: tick (trapezoid)", "profile: tick (S-curve)"};
+   for (uint8_t i = 0; i < 2; i++) {
+     profile.setShape(shapes[i]);
+     profile.prepare(longMove, 500);
+     report(names[i], measure([&]() {
+       if (!profile.tick()) {
+         profile.prepare(longMove, 500);
+       }
+       benchmarkSink = profile.getDistance();
+     }));
+   }
+
+   // A long diagonal move fast enough to step on every call
+   StepEngine engine;
+   engine.onStep(countSteps);
+   engine.getPlanner().setSpeed(1e6f);
+   engine.getPlanner().setAcceleration(1e9f);
+   bool away = false;
+   report("step engine: isr() stepping every call", measure([&]() {
+     if (!engine.isMoving()) {
+       away = !away;
+       queueMove(away ? "ABSOLUTE_MOVE 1000 700 300\n" : "ABSOLUTE_MOVE 0 0 0\n");
+       engine.update(parser);
+     }
+     engine.isr();
+     if (!engine.isMoving()) {
+       engine.update(parser);
+       Serial.takeOutput();
+     }
+   }));
+   while (parser.finishMove()) {
+   }
+   Serial.takeOutput();
+ }
+
+ /**
+  * Helper function to time isr() over whole moves at a given speed. The
+  * moves go back and forth, each one is loaded as soon as the previous one
+  * ends, so the time includes the profile ticks and the ramps.
+  *
+  * @param speed Cruise speed in mm/s, 0 to time isr() with no move
+  * @return Nanoseconds per isr() call
+  */
+ static double measureIsr(float speed) {
+   StepEngine engine;
+   engine.onStep(countSteps);
+   engine.getPlanner().setSpeed(speed > 0 ? speed : 1);
+   engine.getPlanner().setAcceleration(5000);
+   bool away = false;
+   double nanoseconds = measure([&]() {
+     if (speed > 0 && !engine.isMoving()) {
+       engine.update(parser);
+       away = !away;
+       queueMove(away ? "ABSOLUTE_MOVE 100 70 30\n" : "ABSOLUTE_MOVE 0 0 0\n");
+       engine.update(parser);
+     }
+     engine.isr();
+   });
+   engine.update(parser);
+   while (parser.finishMove()) {
+   }
+   Serial.takeOutput();
+   return nanoseconds;
+ }
+
+ /**
+  * Compares the cost of isr() with its budget, the time between two calls at
+  * STEP_TICK_RATE. The host is much faster than an AVR, so the share of the
+  * budget is a lower bound; on a board the same share is found by scaling
+  * with the ratio of the two clocks.
+  */
+ static void benchmarkIsrBudget() {
+   double budget = 1e9 / STEP_TICK_RATE;
+   printf("\nStep interrupt budget (STEP_TICK_RATE %d Hz, %.0f ns per call, %.0f steps/mm)\n",
+          STEP_TICK_RATE, budget, (double)STEPS_PER_MM);
+   printf("  %-20s %14s %12s %12s\n", "speed (mm/s)", "steps/s", "ns/call", "budget");
+   float limit = (float)STEP_TICK_RATE / STEPS_PER_MM;
+   float fractions[] = {0, 0.25f, 0.5f, 1.0f, 2.0f};
+   for (uint8_t i = 0; i < sizeof(fractions) / sizeof(fractions[0]); i++) {
+     float speed = limit * fractions[i];
+     double nanoseconds = measureIsr(speed);
+     // The x axis moves the most, so it is the one limited to STEP_TICK_RATE
+     float rate = speed * STEPS_PER_MM * 100 / sqrtf(100 * 100 + 70 * 70 + 30 * 30);
+     printf("  %-20.2f %14.0f %12.1f %11.3f%%\n", speed, rate < STEP_TICK_RATE ? rate : STEP_TICK_RATE,
+            nanoseconds, nanoseconds * 100 / budget);
+   }
+ }
+
+ int main() {
+   parser.begin();
+   parser.useMotionQueue(true);
+   Serial.setWriteRoom(4096);
+
+   benchmarkModules();
+   benchmarkIsrBudget();
+   return 0;
+ }
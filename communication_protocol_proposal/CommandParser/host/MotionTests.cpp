@@ -0,0 +1,295 @@
+/**
+ * MotionTests.cpp - Host tests of the motion modules of the COXIRIS
+ *                   Positioning System command parser.
+ *
+ * The planner and the profile are checked on their own, the step engine with
+ * moves queued through read() and its interrupt called by the test.
+ */
+
+ #include <string>
+ #include "Check.h"
+ #include "CommandParser.h"
+ #include "StepEngine.h"
+
+ CommandParser parser;
+
+ // Position in steps counted from the step callback, and the steps it got
+ static int32_t stepped[MOTION_AXES];
+ static uint32_t stepCalls = 0;
+
+ void countSteps(uint8_t steps, uint8_t directions) {
+   for (uint8_t axis = 0; axis < MOTION_AXES; axis++) {
+     if (steps & 1 << axis) {
+       stepped[axis] += directions & 1 << axis ? -1 : 1;
+     }
+   }
+   stepCalls++;
+ }
+
+ /**
+  * Helper function to queue a move, the way MotionQueue receives it from
+  * the parser.
+  *
+  * @param queue The queue
+  * @param command CMD_ABSOLUTE_MOVE, CMD_DELTA_MOVE or CMD_GO_HOME
+  * @param x Target or offset in fixed point
+  * @param y Target or offset in fixed point
+  * @param z Target or offset in fixed point
+  */
+ static void push(MotionQueue& queue, uint8_t command, int32_t x, int32_t y, int32_t z) {
+   MotionCommand move = {};
+   move.command = command;
+   move.values[0] = x;
+   move.values[1] = y;
+   move.values[2] = z;
+   CHECK(queue.push(move));
+ }
+
+ /**
+  * Helper function to check that two speeds match.
+  *
+  * @param speed The speed
+  * @param expected The expected speed
+  * @return true if they differ by less than 1 µm/s
+  */
+ static bool near(float speed, float expected) {
+   return fabs(speed - expected) < 0.001f;
+ }
+
+ /**
+  * Checks the lengths and the junction speeds of the planner, and that every
+  * move can change its speed within the acceleration.
+  */
+ static void testPlanner() {
+   MotionPlanner planner;
+   planner.setSpeed(10);
+   planner.setAcceleration(500);
+   planner.setDeviation(0.01f);
+   const int32_t home[MOTION_AXES] = {0, 0, 0};
+
+   // Straight on, a right angle and back the same way
+   MotionQueue queue;
+   push(queue, CommandParser::CMD_ABSOLUTE_MOVE, 10000, 0, 0);
+   push(queue, CommandParser::CMD_DELTA_MOVE, 10000, 0, 0);
+   push(queue, CommandParser::CMD_DELTA_MOVE, 0, 30000, 40000);
+   push(queue, CommandParser::CMD_DELTA_MOVE, 0, -3000, -4000);
+   planner.plan(queue, home, 0);
+   const PlannedMove* moves[4];
+   for (uint8_t i = 0; i < 4; i++) {
+     moves[i] = planner.getMove(i);
+     CHECK(moves[i] != nullptr);
+   }
+   CHECK(planner.getMove(4) == nullptr);
+   CHECK(near(moves[0]->length, 10) && near(moves[1]->length, 10));
+   CHECK(near(moves[2]->length, 50) && near(moves[3]->length, 5));
+   CHECK(near(moves[0]->entrySpeed, 0) && near(moves[0]->exitSpeed, 10) && near(moves[0]->cruiseSpeed, 10));
+   float sinHalf = sqrt(0.5f);
+   float corner = sqrt(500 * 0.01f * sinHalf / (1 - sinHalf));
+   CHECK(near(moves[1]->entrySpeed, 10) && near(moves[1]->exitSpeed, corner));
+   CHECK(near(moves[2]->entrySpeed, corner) && near(moves[2]->exitSpeed, 0));
+   CHECK(near(moves[3]->entrySpeed, 0) && near(moves[3]->exitSpeed, 0));
+
+   // A short last move limits the exit speed of the move before it
+   queue.clear();
+   push(queue, CommandParser::CMD_ABSOLUTE_MOVE, 10000, 0, 0);
+   push(queue, CommandParser::CMD_ABSOLUTE_MOVE, 10001, 0, 0);
+   planner.plan(queue, home, 0);
+   CHECK(near(planner.getMove(0)->exitSpeed, 1));  // sqrt(2 * 500 * 0.001)
+   CHECK(near(planner.getMove(1)->entrySpeed, 1) && near(planner.getMove(1)->exitSpeed, 0));
+
+   // Planning from the second move on, where the first one ends
+   const int32_t end[MOTION_AXES] = {10000, 0, 0};
+   planner.plan(queue, end, 1, 1);
+   CHECK(planner.getMove(0) != nullptr && planner.getMove(1) == nullptr);
+   CHECK(near(planner.getMove(0)->length, 0.001f) && near(planner.getMove(0)->entrySpeed, 1));
+
+   int32_t position[MOTION_AXES] = {1000, 2000, 3000};
+   MotionCommand move = {};
+   move.command = CommandParser::CMD_DELTA_MOVE;
+   move.values[0] = -500;
+   MotionPlanner::advance(move, position);
+   CHECK(position[0] == 500 && position[1] == 2000 && position[2] == 3000);
+   move.command = CommandParser::CMD_ABSOLUTE_MOVE;
+   MotionPlanner::advance(move, position);
+   CHECK(position[0] == -500 && position[1] == 0 && position[2] == 0);
+   position[1] = 7;
+   move.command = CommandParser::CMD_GO_HOME;
+   MotionPlanner::advance(move, position);
+   CHECK(position[0] == 0 && position[1] == 0 && position[2] == 0);
+
+   // Accelerations too low to plan with are raised to the minimum
+   planner.setAcceleration(0);
+   CHECK(planner.getAcceleration() == PLANNER_MIN_ACCELERATION);
+   planner.setAcceleration(-500);
+   CHECK(planner.getAcceleration() == PLANNER_MIN_ACCELERATION);
+   planner.setAcceleration(NAN);
+   CHECK(planner.getAcceleration() == PLANNER_MIN_ACCELERATION);
+   planner.setAcceleration(2000);
+   CHECK(planner.getAcceleration() == 2000);
+ }
+
+ /**
+  * Helper function to follow a profile to its end, checking that it never
+  * goes back, exceeds the speed or changes the speed faster than allowed.
+  *
+  * @param profile The prepared profile
+  * @param highest Highest speed in units per tick
+  * @param change Highest change of the speed in one tick, units per tick
+  * @return Number of ticks of the move
+  */
+ static uint32_t follow(MotionProfile& profile, float highest, float change) {
+   uint32_t ticks = 0;
+   int32_t distance = profile.getDistance();
+   int32_t speed = profile.getSpeed();
+   bool monotonic = true;
+   bool withinSpeed = true;
+   bool withinChange = true;
+   while (profile.tick() && ticks < 1000000) {
+     ticks++;
+     monotonic = monotonic && profile.getDistance() >= distance;
+     withinSpeed = withinSpeed && profile.getSpeed() <= highest * 65536 + 1;
+     withinChange = withinChange && abs(profile.getSpeed() - speed) <= change * 65536 + 1;
+     distance = profile.getDistance();
+     speed = profile.getSpeed();
+   }
+   CHECK(monotonic);
+   CHECK(withinSpeed);
+   CHECK(withinChange);
+   CHECK(profile.isFinished());
+   return ticks + 1;
+ }
+
+ /**
+  * Checks that a profile covers exactly the length of its move, in the time
+  * the speed and the acceleration allow.
+  */
+ static void testProfile() {
+   // 10 mm at 10 mm/s with 500 mm/s^2: 10 units per tick, 0.5 units per tick^2
+   const PlannedMove move = {10, 0, 10, 0};
+   MotionProfile profile;
+   profile.prepare(move, 500);
+   CHECK(!profile.isFinished() && profile.getDistance() == 0);
+   // 20 ticks up, 980 cruising and 20 down
+   CHECK(follow(profile, 10, 0.5f) == 1020);
+   CHECK(profile.getDistance() == 10000 && profile.getSpeed() == 0);
+   CHECK(!profile.tick());
+
+   // The S-curve peaks at twice the mean acceleration of its ramps
+   profile.setShape(MotionProfile::PROFILE_S_CURVE);
+   profile.prepare(move, 500);
+   CHECK(follow(profile, 10, 1) == 1020);
+   CHECK(profile.getDistance() == 10000);
+
+   // Entering and leaving at speed, and too short to reach the cruise speed
+   const PlannedMove moves[] = {{5, 5, 10, 2}, {0.01f, 0, 10, 0}, {1, 3, 10, 3}};
+   const int32_t lengths[] = {5000, 10, 1000};
+   for (uint8_t i = 0; i < 3; i++) {
+     for (uint8_t shape = 0; shape < 2; shape++) {
+       profile.setShape(shape ? MotionProfile::PROFILE_S_CURVE : MotionProfile::PROFILE_TRAPEZOID);
+       profile.prepare(moves[i], 500);
+       follow(profile, 10, shape ? 1 : 0.5f);
+       CHECK(profile.getDistance() == lengths[i]);
+     }
+   }
+
+   // Without acceleration the profile ramps at PLANNER_MIN_ACCELERATION
+   const float slow[] = {0, 1e-30f, -500};
+   profile.setShape(MotionProfile::PROFILE_TRAPEZOID);
+   for (uint8_t i = 0; i < 3; i++) {
+     profile.prepare(move, slow[i]);
+     CHECK(follow(profile, 10, PLANNER_MIN_ACCELERATION * 0.001f) > 1020);
+     CHECK(profile.getDistance() == 10000);
+   }
+
+   // A move of zero length is finished at once
+   const PlannedMove still = {0, 0, 10, 0};
+   profile.prepare(still, 500);
+   CHECK(profile.isFinished() && profile.getDistance() == 0 && !profile.tick());
+ }
+
+ /**
+  * Helper function to queue a move through the parser.
+  *
+  * @param line The command, with its line ending
+  * @return The ACK line
+  */
+ static std::string queueMove(const char* line) {
+   Serial.inject(line);
+   parser.read();
+   return Serial.takeOutput();
+ }
+
+ /**
+  * Helper function to run the step engine until the motion queue is empty.
+  *
+  * @param engine The engine
+  * @return Number of isr() calls
+  */
+ static uint32_t runMoves(StepEngine& engine) {
+   uint32_t calls = 0;
+   engine.update(parser);
+   while ((engine.isMoving() || parser.getMotionQueue().size() > 0) && calls < 10000000) {
+     engine.isr();
+     engine.update(parser);
+     parser.read();
+     calls++;
+   }
+   CHECK(!engine.isMoving() && parser.getMotionQueue().size() == 0);
+   return calls;
+ }
+
+ /**
+  * Checks that the step engine reaches the queued targets with the right
+  * steps and directions, one step per axis and call at most, sends the DONE
+  * of each move once it is finished, and takes the time the speed asks for.
+  */
+ static void testStepEngine() {
+   parser.begin();
+   parser.useMotionQueue(true);
+   Serial.setWriteRoom(4096);
+   StepEngine engine;
+   engine.onStep(countSteps);
+
+   CHECK(queueMove("#1 ABSOLUTE_MOVE 10 -5 2.5\n") ==
+         "#1 ACK ABSOLUTE_MOVE: " + std::to_string(MOTION_QUEUE_DEPTH - 1) + "\r\n");
+   CHECK(queueMove("DELTA_MOVE -10 5 0.0125\n") == "ACK DELTA_MOVE: " + std::to_string(MOTION_QUEUE_DEPTH - 2) + "\r\n");
+   runMoves(engine);
+   CHECK(Serial.takeOutput() == "#1 DONE ABSOLUTE_MOVE\r\nDONE DELTA_MOVE\r\n");
+   // 0.0125 mm is exactly one step at 80 steps/mm
+   CHECK(engine.getSteps(0) == 0 && engine.getSteps(1) == 0 && engine.getSteps(2) == 201);
+   CHECK(stepped[0] == 0 && stepped[1] == 0 && stepped[2] == 201);
+
+   // A single move, 100 mm at 10 mm/s with 500 mm/s^2 takes 10.02 s
+   engine.getPlanner().setSpeed(10);
+   engine.getPlanner().setAcceleration(500);
+   uint32_t before = stepCalls;
+   queueMove("DELTA_MOVE 100 0 0\n");
+   uint32_t calls = runMoves(engine);
+   CHECK(stepCalls - before == 8000);
+   CHECK(calls >= 10.02 * STEP_TICK_RATE && calls <= 10.03 * STEP_TICK_RATE);
+   CHECK(engine.getSteps(0) == 8000 && stepped[0] == 8000);
+   Serial.takeOutput();
+
+   // Home is only moved while the axes are still
+   engine.setHome();
+   CHECK(engine.getSteps(0) == 0 && engine.getSteps(2) == 0);
+   queueMove("ABSOLUTE_MOVE -1 0 0\n");
+   engine.update(parser);
+   engine.isr();
+   CHECK(engine.isMoving());
+   engine.setHome();
+   runMoves(engine);
+   CHECK(engine.getSteps(0) == -80 && stepped[0] == 8000 - 80);
+   CHECK(Serial.takeOutput() == "DONE ABSOLUTE_MOVE\r\n");
+   CHECK(queueMove("GO_HOME\n") == "ACK GO_HOME: " + std::to_string(MOTION_QUEUE_DEPTH - 1) + "\r\n");
+   runMoves(engine);
+   CHECK(engine.getSteps(0) == 0 && engine.getSteps(1) == 0 && engine.getSteps(2) == 0);
+   CHECK(Serial.takeOutput() == "DONE GO_HOME\r\n");
+ }
+
+ int main() {
+   testPlanner();
+   testProfile();
+   testStepEngine();
+   return checkResult();
+ }
@@ -0,0 +1,234 @@
+/**
+ * ParserBenchmark.cpp - Host benchmarks of the COXIRIS Positioning System
+ *                       command parser.
+ *
+ * The first section times each stage of the parser on its own, next to the
+ * standard library call it replaced (strcmp ladder, strtod, snprintf). The
+ * second one replays batches of each command type through read(), from the
+ * received bytes to the drained response, so parser changes can be judged on
+ * numbers instead of guesses.
+ */
+
+ #include <stdlib.h>
+ #include "Benchmark.h"
+ #include "CommandParser.h"
+ #include "NumberFormatter.h"
+
+ #define BENCHMARK_BATCH 256  // Commands replayed by each read() benchmark call
+
+ // Command names in table order, for the strcmp ladder the hash replaced
+ #define COMMAND_NAME(name, ...) #name,
+ static const char* const NAMES[] = {COMMAND_LIST(COMMAND_NAME)};
+ #undef COMMAND_NAME
+ static const size_t NAME_COUNT = sizeof(NAMES) / sizeof(NAMES[0]);
+
+ // Numbers as a host sends them
+ static const char* const NUMBERS[] = {"12.5", "-3.25", "0.001", "100", "-0.5", "250.125", "7", "1e2"};
+ static const size_t NUMBER_COUNT = sizeof(NUMBERS) / sizeof(NUMBERS[0]);
+
+ CommandParser parser;
+
+ void move(int32_t &x, int32_t &y, int32_t &z) {
+   benchmarkSink = x + y + z;
+ }
+
+ void getPosition(int32_t &x, int32_t &y, int32_t &z) {
+   x = 12500;
+   y = -3250;
+   z = 1;
+ }
+
+ void setValue(int32_t &value) {
+   benchmarkSink = value;
+ }
+
+ void getValue(int32_t &value) {
+   value = 20000;
+ }
+
+ void action() {
+ }
+
+ /**
+  * Times each stage on its own.
+  */
+ static void benchmarkStages() {
+   reportSection("Stages");
+
+   size_t index = 0;
+   report("lookup: perfect hash", measure([&]() {
+     const char* name = NAMES[index++ % NAME_COUNT];
+     benchmarkSink = CommandParserBase::lookupCommand(name, strlen(name));
+   }));
+   report("lookup: strcmp ladder", measure([&]() {
+     const char* name = NAMES[index++ % NAME_COUNT];
+     size_t id = 0;
+     while (id < NAME_COUNT && strcmp(name, NAMES[id]) != 0) {
+       id++;
+     }
+     benchmarkSink = id;
+   }));
+
+   report("number: NumberParser to float", measure([&]() {
+     const char* number = NUMBERS[index++ % NUMBER_COUNT];
+     float value;
+     NumberParser().parse(number, strlen(number), value);
+     benchmarkSink = (uint32_t)value;
+   }));
+   report("number: NumberParser to fixed point", measure([&]() {
+     const char* number = NUMBERS[index++ % NUMBER_COUNT];
+     NumberParser numberParser;
+     for (const char* c = number; *c != '\0'; c++) {
+       numberParser.feed(*c);
+     }
+     int32_t value = 0;
+     if (numberParser.finish() == NumberParser::NUMBER_OK) {
+       numberParser.toFixed(FIXED_POINT_DECIMALS, value);
+     }
+     benchmarkSink = value;
+   }));
+   report("number: strtod", measure([&]() {
+     benchmarkSink = (uint32_t)strtod(NUMBERS[index++ % NUMBER_COUNT], nullptr);
+   }));
+
+   char text[NUMBER_FORMAT_SIZE + 16];
+   int32_t fixed = -1234567;
+   report("format: NumberFormatter fixed point", measure([&]() {
+     benchmarkSink = NumberFormatter::formatFixed(text, fixed++, FIXED_POINT_DECIMALS, 2);
+   }));
+   report("format: NumberFormatter float", measure([&]() {
+     benchmarkSink = NumberFormatter::formatFloat(text, fixed++ * 0.001f, 2);
+   }));
+   report("format: snprintf %.2f", measure([&]() {
+     benchmarkSink = snprintf(text, sizeof(text), "%.2f", fixed++ * 0.001);
+   }));
+
+   uint8_t frame[1 + 3 + MOTION_AXES * 4 + 2 + 1] = {};
+   report("frame: CRC16 and COBS encode (move)", measure([&]() {
+     frame[1] = CommandParserBase::CMD_ABSOLUTE_MOVE;
+     frame[4] = (uint8_t)index++;
+     size_t length = 3 + MOTION_AXES * 4;
+     uint16_t crc = FrameCodec::crc16(frame + 1, length);
+     frame[1 + length] = crc;
+     frame[2 + length] = crc >> 8;
+     benchmarkSink = FrameCodec::encode(frame, length + 2);
+   }));
+   report("frame: COBS decode and CRC16 (move)", measure([&]() {
+     uint8_t copy[sizeof(frame)];
+     memcpy(copy, frame, sizeof(copy));
+     int length = FrameCodec::decode(copy, sizeof(copy) - 1);
+     benchmarkSink = FrameCodec::crc16(copy, length - 2);
+   }));
+
+   static const char LINE[] = "DONE GET_POSITION: 12.50 -3.25 0.00\r\n";
+   TxBuffer tx;
+   tx.begin(Serial);
+   report("tx: write and drain a response line", measure([&]() {
+     tx.write(LINE, sizeof(LINE) - 1);
+     tx.drain();
+     Serial.takeOutput();
+   }));
+ }
+
+ /**
+  * Helper function to time a batch of commands through read().
+  *
+  * @param name What is reported
+  * @param input Bytes of one command, replayed BENCHMARK_BATCH times per call
+  * @param length Number of bytes
+  * @param commands Commands in the input
+  */
+ static void benchmarkInput(const char* name, const void* input, size_t length, size_t commands) {
+   std::string batch;
+   for (int i = 0; i < BENCHMARK_BATCH; i++) {
+     batch.append((const char*)input, length);
+   }
+   report(name, measure([&]() {
+     Serial.inject(batch.data(), batch.size());
+     while (Serial.available() > 0) {
+       parser.read();
+     }
+     parser.read();
+     benchmarkSink = Serial.takeOutput().size();
+   }, BENCHMARK_BATCH * commands));
+ }
+
+ /**
+  * Helper function to time a text command through read().
+  *
+  * @param line The command, with its line ending
+  * @param commands Commands in the line
+  */
+ static void benchmarkLine(const char* line, size_t commands = 1) {
+   char name[64];
+   snprintf(name, sizeof(name), "%.*s", (int)strcspn(line, "\n"), line);
+   benchmarkInput(name, line, strlen(line), commands);
+ }
+
+ /**
+  * Times every command type from the received bytes to the drained response.
+  */
+ static void benchmarkCommands() {
+   reportSection("Commands through read() (text)");
+   benchmarkLine("GET_ID\n");
+   benchmarkLine("GET_POSITION\n");
+   benchmarkLine("get_speed\n");
+   benchmarkLine("SET_SPEED 20.5\n");
+   benchmarkLine("ABSOLUTE_MOVE 12.5 -3.25 0.001\n");
+   benchmarkLine("DELTA_MOVE 1 1 1\n");
+   benchmarkLine("#42 DELTA_MOVE 1 1 1\n");
+   benchmarkLine("DELTA_MOVE 1 0 0; DELTA_MOVE 0 1 0; GET_POSITION\n", 3);
+   benchmarkLine("  ABSOLUTE_MOVE   12.5   -3.25   0.001  \n");
+   benchmarkLine("UNKNOWN_COMMAND\n");
+   benchmarkLine("ABSOLUTE_MOVE 12.5 x 0\n");
+
+   reportSection("Commands through read() (binary)");
+   Serial.inject("BINARY\n");
+   parser.read();
+   parser.read();
+   Serial.takeOutput();
+   static const struct {
+     const char* name;
+     CommandParserBase::CommandId id;
+     uint8_t arity;
+   } FRAMES[] = {
+     {"GET_ID frame", CommandParserBase::CMD_GET_ID, 0},
+     {"GET_POSITION frame", CommandParserBase::CMD_GET_POSITION, 0},
+     {"ABSOLUTE_MOVE frame", CommandParserBase::CMD_ABSOLUTE_MOVE, 3},
+   };
+   for (size_t i = 0; i < sizeof(FRAMES) / sizeof(FRAMES[0]); i++) {
+     uint8_t frame[1 + 3 + MOTION_AXES * 4 + 2 + 1] = {};
+     frame[1] = FRAMES[i].id;
+     frame[2] = 7;  // Tag
+     size_t length = 3;
+     for (uint8_t axis = 0; axis < FRAMES[i].arity && axis < MOTION_AXES; axis++) {
+       int32_t value = 12500 * (axis + 1);
+       memcpy(frame + 1 + length, &value, 4);  // Little endian hosts only
+       length += 4;
+     }
+     uint16_t crc = FrameCodec::crc16(frame + 1, length);
+     frame[1 + length] = crc;
+     frame[2 + length] = crc >> 8;
+     size_t encoded = FrameCodec::encode(frame, length + 2);
+     benchmarkInput(FRAMES[i].name, frame, encoded, 1);
+   }
+ }
+
+ int main() {
+   parser.begin();
+   parser.on(CommandParser::CMD_SET_HOME, action);
+   parser.on(CommandParser::CMD_GO_HOME, action);
+   parser.on(CommandParser::CMD_CHECK_ERRORS, action);
+   parser.on(CommandParser::CMD_ABSOLUTE_MOVE, move);
+   parser.on(CommandParser::CMD_DELTA_MOVE, move);
+   parser.on(CommandParser::CMD_GET_POSITION, getPosition);
+   parser.on(CommandParser::CMD_SET_SPEED, setValue);
+   parser.on(CommandParser::CMD_GET_SPEED, getValue);
+   parser.on(CommandParser::CMD_GET_MIN_SPEED, getValue);
+   parser.on(CommandParser::CMD_GET_MAX_SPEED, getValue);
+   Serial.setWriteRoom(4096);  // Time the parser, not the UART
+
+   benchmarkStages();
+   benchmarkCommands();
+   return 0;
+ }
@@ -0,0 +1,94 @@
+/**
+ * ParserConsole.cpp - Runs the COXIRIS Positioning System command parser on a
+ *                     host (Linux) machine.
+ *
+ * Every line read from stdin is sent to the parser as if it came from the
+ * serial port, and the responses are written to stdout. The moves are run by
+ * the step engine on the simulated clock, so a 10 s move takes 10 s of
+ * simulated time and no real time.
+ */
+
+ #include <stdio.h>
+ #include "CommandParser.h"
+ #include "StepEngine.h"
+
+ #define CONSOLE_MAX_RUN 60000000UL  // Longest simulated time per input line in microseconds
+
+ CommandParser parser;
+ StepEngine engine;
+ int32_t speed = 10000;  // µm/s
+
+ void setHome() {
+   engine.setHome();
+ }
+
+ void getPosition(int32_t &x, int32_t &y, int32_t &z) {
+   x = (int32_t)(engine.getSteps(0) * 1000 / STEPS_PER_MM);
+   y = (int32_t)(engine.getSteps(1) * 1000 / STEPS_PER_MM);
+   z = (int32_t)(engine.getSteps(2) * 1000 / STEPS_PER_MM);
+ }
+
+ void setSpeed(int32_t &value) {
+   speed = value;
+   engine.getPlanner().setSpeed(value / 1000.0f);
+ }
+
+ void getSpeed(int32_t &value) {
+   value = speed;
+ }
+
+ void getMinSpeed(int32_t &value) {
+   value = 1;
+ }
+
+ void getMaxSpeed(int32_t &value) {
+   value = 100000;
+ }
+
+ void checkErrors() {
+ }
+
+ /**
+  * Runs the parser and the step engine until every command and move is done.
+  * A position stream only sends samples while this runs.
+  */
+ static void run() {
+   for (unsigned long elapsed = 0; elapsed < CONSOLE_MAX_RUN; elapsed += 1000000UL / PROFILE_TICK_RATE) {
+     for (uint8_t i = 0; i < STEP_TICKS_PER_PROFILE; i++) {
+       engine.isr();
+       hostAdvanceMicros(1000000UL / STEP_TICK_RATE);
+     }
+     parser.read();
+     engine.update(parser);
+     if (Serial.available() == 0 && !engine.isMoving() && parser.currentMove() == nullptr) {
+       break;
+     }
+   }
+   parser.read();
+ }
+
+ int main() {
+   parser.begin();
+   parser.useMotionQueue(true);
+   parser.on(CommandParser::CMD_SET_HOME, setHome);
+   parser.on(CommandParser::CMD_CHECK_ERRORS, checkErrors);
+   parser.on(CommandParser::CMD_GET_POSITION, getPosition);
+   parser.on(CommandParser::CMD_SET_SPEED, setSpeed);
+   parser.on(CommandParser::CMD_GET_SPEED, getSpeed);
+   parser.on(CommandParser::CMD_GET_MIN_SPEED, getMinSpeed);
+   parser.on(CommandParser::CMD_GET_MAX_SPEED, getMaxSpeed);
+
+   char line[256];
+   while (fgets(line, sizeof(line), stdin) != nullptr) {
+     Serial.inject(line);
+     // Long responses such as HELP are sent over several read() calls
+     std::string output;
+     do {
+       run();
+       output = Serial.takeOutput();
+       fwrite(output.data(), 1, output.size(), stdout);
+     } while (!output.empty());
+     fflush(stdout);
+   }
+   return 0;
+ }
@@ -0,0 +1,714 @@
+/**
+ * ParserTests.cpp - Host tests of the COXIRIS Positioning System command parser.
+ *
+ * The numbers, frames and transmit ring are checked directly, the commands
+ * through read() and the Serial of the host Arduino core, as a sketch runs them.
+ */
+
+ #include <string>
+ #include <vector>
+ #include "Check.h"
+ #include "CommandParser.h"
+ #include "FrameCodec.h"
+ #include "NumberParser.h"
+ #include "TxBuffer.h"
+
+ /**
+  * Helper function to parse a number and convert it to fixed point.
+  *
+  * @param text The number
+  * @param value Where the fixed point value is stored
+  * @return true if the number is valid and fits in an int32
+  */
+ static bool parseFixed(const char* text, int32_t& value) {
+   NumberParser number;
+   for (const char* c = text; *c != '\0'; c++) {
+     number.feed(*c);
+   }
+   return number.finish() == NumberParser::NUMBER_OK && number.toFixed(FIXED_POINT_DECIMALS, value);
+ }
+
+ /**
+  * Helper function to parse a number and return its status.
+  *
+  * @param text The number
+  * @param position Where the position of the error is stored
+  * @return The status of finish()
+  */
+ static NumberParser::Status parseStatus(const char* text, uint8_t& position) {
+   NumberParser number;
+   for (const char* c = text; *c != '\0'; c++) {
+     number.feed(*c);
+   }
+   NumberParser::Status status = number.finish();
+   position = number.getErrorPosition();
+   return status;
+ }
+
+ /**
+  * Checks the rounding and the range of NumberParser::toFixed() and the
+  * errors of finish().
+  */
+ static void testNumbers() {
+   int32_t value = 0;
+   CHECK(parseFixed("12", value) && value == 12000);
+   CHECK(parseFixed("1.2344", value) && value == 1234);
+   CHECK(parseFixed("1.2345", value) && value == 1235);  // Halves round away from zero
+   CHECK(parseFixed("-1.2345", value) && value == -1235);
+   CHECK(parseFixed("0.0004", value) && value == 0);
+   CHECK(parseFixed("0.0005", value) && value == 1);
+   CHECK(parseFixed("1e-3", value) && value == 1);
+   CHECK(parseFixed("1e-12", value) && value == 0);
+   CHECK(parseFixed(".5", value) && value == 500);
+   CHECK(parseFixed("2147483", value) && value == 2147483000);
+   CHECK(parseFixed("-2147483", value) && value == -2147483000);
+   CHECK(!parseFixed("2147484", value));
+   CHECK(!parseFixed("1e9", value));
+
+   uint8_t position = 0;
+   CHECK(parseStatus("", position) == NumberParser::NUMBER_EMPTY);
+   CHECK(parseStatus("-", position) == NumberParser::NUMBER_EMPTY);
+   CHECK(parseStatus("1.2.3", position) == NumberParser::NUMBER_UNEXPECTED && position == 3);
+   CHECK(parseStatus("12x", position) == NumberParser::NUMBER_UNEXPECTED && position == 2);
+   CHECK(parseStatus("1e", position) == NumberParser::NUMBER_UNEXPECTED && position == 2);
+   CHECK(parseStatus("1e99", position) == NumberParser::NUMBER_OUT_OF_RANGE);
+
+   // Past the largest float, 3.4028235e38, with the same decimal exponent
+   CHECK(parseStatus("5e38", position) == NumberParser::NUMBER_OUT_OF_RANGE);
+   CHECK(parseStatus("3.5e38", position) == NumberParser::NUMBER_OUT_OF_RANGE);
+   CHECK(parseStatus("-9.9e38", position) == NumberParser::NUMBER_OUT_OF_RANGE);
+   CHECK(parseStatus("3.40282351e38", position) == NumberParser::NUMBER_OUT_OF_RANGE);
+   CHECK(parseStatus("340282350000000000000000000000000000001", position) == NumberParser::NUMBER_OK);
+   CHECK(parseStatus("340282360000000000000000000000000000000", position) == NumberParser::NUMBER_OUT_OF_RANGE);
+   CHECK(parseStatus("3.4028235e38", position) == NumberParser::NUMBER_OK);
+   CHECK(parseStatus("-3.4e38", position) == NumberParser::NUMBER_OK);
+   CHECK(parseStatus("0.00034e42", position) == NumberParser::NUMBER_OK);
+   NumberParser largest;
+   for (const char* c = "3.4028235e38"; *c != '\0'; c++) {
+     largest.feed(*c);
+   }
+   CHECK(largest.finish() == NumberParser::NUMBER_OK && !isinf(largest.toFloat()));
+ }
+
+ /**
+  * Checks that a frame survives COBS and its CRC, and that damaged frames are
+  * rejected.
+  */
+ static void testFrames() {
+   // [opcode][tag][payload][CRC], with zeros in the tag and the payload
+   const uint8_t contents[] = {0x03, 0x00, 0x11, 0x00, 0x00, 0x01, 0x02, 0x00, 0xFF};
+   const size_t length = sizeof(contents) + 2;
+   uint8_t frame[1 + length + 1];
+   memcpy(frame + 1, contents, sizeof(contents));
+   uint16_t crc = FrameCodec::crc16(contents, sizeof(contents));
+   frame[1 + sizeof(contents)] = crc & 0xFF;
+   frame[2 + sizeof(contents)] = crc >> 8;
+   uint8_t original[length];
+   memcpy(original, frame + 1, length);
+
+   CHECK(FrameCodec::crc16((const uint8_t*)"123456789", 9) == 0x29B1);  // CRC16-CCITT check value
+   size_t encoded = FrameCodec::encode(frame, length);
+   CHECK(encoded == length + 2);
+   CHECK(frame[encoded - 1] == FRAME_DELIMITER);
+   CHECK(memchr(frame, FRAME_DELIMITER, encoded - 1) == nullptr);
+
+   uint8_t damaged[sizeof(frame)];
+   memcpy(damaged, frame, encoded);
+
+   int decoded = FrameCodec::decode(frame, encoded - 1);
+   CHECK(decoded == (int)length);
+   CHECK(memcmp(frame, original, length) == 0);
+   CHECK(FrameCodec::crc16(frame, length - 2) == (frame[length - 2] | frame[length - 1] << 8));
+
+   // A flipped bit in a data byte (not a COBS code) still decodes, but fails the CRC
+   damaged[3] ^= 0x10;
+   decoded = FrameCodec::decode(damaged, encoded - 1);
+   CHECK(decoded == (int)length);
+   CHECK(FrameCodec::crc16(damaged, length - 2) != (damaged[length - 2] | damaged[length - 1] << 8));
+
+   // A COBS code past the end and a zero inside the frame are malformed
+   uint8_t overrun[] = {0x05, 0x01, 0x02};
+   CHECK(FrameCodec::decode(overrun, sizeof(overrun)) == -1);
+   uint8_t zero[] = {0x02, 0x01, 0x00, 0x01};
+   CHECK(FrameCodec::decode(zero, sizeof(zero)) == -1);
+ }
+
+ /**
+  * Checks that the transmit ring keeps the bytes in order across its end and
+  * drops and counts whole writes that do not fit.
+  */
+ static void testTxBuffer() {
+   HardwareSerial port;
+   TxBuffer tx;
+   tx.begin(port);
+   port.setWriteRoom(0);
+
+   // Three quarters of the ring, so the second write wraps and fills it
+   const size_t size = TX_BUFFER_SIZE * 3 / 4;
+   char first[size];
+   char second[size];
+   for (size_t i = 0; i < size; i++) {
+     first[i] = (char)('a' + i % 26);
+     second[i] = (char)('A' + i % 26);
+   }
+   CHECK(tx.write(first, sizeof(first)));
+   port.setWriteRoom(TX_BUFFER_SIZE / 2);
+   tx.drain();
+   CHECK(tx.pending() == TX_BUFFER_SIZE / 4);
+   CHECK(tx.write(second, sizeof(second)));  // Wraps around the end of the ring
+   CHECK(tx.pending() == TX_BUFFER_SIZE);
+   port.setWriteRoom(TX_BUFFER_SIZE);
+   tx.drain();
+   CHECK(tx.pending() == 0);
+   std::string output = port.takeOutput();
+   CHECK(output == std::string(first, sizeof(first)) + std::string(second, sizeof(second)));
+
+   port.setWriteRoom(0);
+   CHECK(tx.write(first, sizeof(first)));
+   CHECK(tx.fits(TX_BUFFER_SIZE - size));
+   CHECK(!tx.fits(TX_BUFFER_SIZE - size + 1));
+   CHECK(!tx.write(second, TX_BUFFER_SIZE / 2));  // Dropped whole, nothing of it is queued
+   CHECK(tx.pending() == size);
+   CHECK(tx.getStats().droppedBytes == TX_BUFFER_SIZE / 2);
+   CHECK(tx.getStats().overflows == 1);
+   CHECK(tx.getStats().highWater == TX_BUFFER_SIZE);
+   port.setWriteRoom(TX_BUFFER_SIZE);
+   tx.drain();
+   CHECK(port.takeOutput() == std::string(first, sizeof(first)));
+ }
+
+ CommandParser parser;
+
+ /**
+  * Helper function to send input to the parser and return its responses.
+  *
+  * @param input The bytes received
+  * @return The bytes sent back
+  */
+ static std::string exchange(const std::string& input) {
+   Serial.inject(input.data(), input.size());
+   for (uint8_t i = 0; i < 8; i++) {
+     parser.read();
+   }
+   return Serial.takeOutput();
+ }
+
+ /**
+  * Checks tagged commands, several commands on one line and lines that are
+  * too long.
+  */
+ static void testLines() {
+   parser.begin();
+   Serial.setWriteRoom(4096);
+
+   CHECK(exchange("GET_ID\n") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(exchange("  get_id  \r") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+
+   CHECK(exchange("#17 GET_ID\n") == "#17 ACK GET_ID\r\n#17 DONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(exchange("#0 GET_ID\n") == "#0 ACK GET_ID\r\n#0 DONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(exchange("#65534 GET_ID\n") == "#65534 ACK GET_ID\r\n#65534 DONE GET_ID: CX25F7TK9P\r\n");
+   const char* invalidTag = "ERROR: Invalid tag, use #0 to #65534 before the command\r\n";
+   CHECK(exchange("#65535 GET_ID\n") == invalidTag);
+   CHECK(exchange("#1x GET_ID\n") == invalidTag);
+   CHECK(exchange("# GET_ID\n") == invalidTag);
+
+   CHECK(exchange("GET_ID;#3 GET_ID\n") ==
+         "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n#3 ACK GET_ID\r\n#3 DONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(exchange(";; GET_ID ;\n") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(exchange("#5 SET_SPEED;GET_ID\n") ==
+         "#5 ACK SET_SPEED\r\n#5 ERROR: Missing parameter - Usage: SET_SPEED speed\r\n#5 DONE SET_SPEED\r\n"
+         "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+
+   // The longest command fits, one more character is too long and the rest of
+   // the command is skipped up to its ';' or the end of the line
+   std::string longest = "SET_SPEED " + std::string(COMMAND_PARSER_BUFFER_SIZE - 2 - 10, '0') + "1\n";
+   CHECK(exchange(longest.c_str()) == "ACK SET_SPEED\r\nERROR: SET_SPEED function not configured\r\nDONE SET_SPEED\r\n");
+   std::string tooLong = "#9 SET_SPEED " + std::string(COMMAND_PARSER_BUFFER_SIZE - 10, '1') + " 2 3\n";
+   CHECK(exchange(tooLong.c_str()) == "#9 ERROR: Command too long\r\n");
+   tooLong = "SET_SPEED " + std::string(COMMAND_PARSER_BUFFER_SIZE - 10, '1') + ";#2 GET_ID\n";
+   CHECK(exchange(tooLong.c_str()) == "ERROR: Command too long\r\n#2 ACK GET_ID\r\n#2 DONE GET_ID: CX25F7TK9P\r\n");
+
+   // Numbers past the largest float are rejected instead of becoming infinite
+   CHECK(exchange("ABSOLUTE_MOVE 1 3.5e38 -9.9e38\n") ==
+         "ACK ABSOLUTE_MOVE\r\nERROR: Number out of range - Argument 2, character 4 - Usage: ABSOLUTE_MOVE x y z\r\n"
+         "DONE ABSOLUTE_MOVE\r\n");
+ }
+
+ /**
+  * Checks that SET_BAUD is only kept by a KEEP_BAUD sent after the switch,
+  * and that the rate falls back when it does not arrive in time.
+  */
+ static void testBaud() {
+   const char* fallback = "ERROR: Baud rate not kept, back to the previous rate\r\n";
+
+   // KEEP_BAUD on the same line or pipelined was sent at the old rate
+   CHECK(exchange("SET_BAUD 9600;KEEP_BAUD\n") == "ACK SET_BAUD\r\nDONE SET_BAUD\r\n");
+   CHECK(Serial.getBaudRate() == 9600);
+   hostAdvanceMicros(BAUD_CONFIRM_TIMEOUT * 1000UL);
+   CHECK(exchange("") == fallback);
+   CHECK(Serial.getBaudRate() == SERIAL_BAUD);
+
+   CHECK(exchange("SET_BAUD 9600\nKEEP_BAUD\n") == "ACK SET_BAUD\r\nDONE SET_BAUD\r\n");
+   CHECK(exchange("GET_ID\n") == "");  // Ignored while KEEP_BAUD is pending
+   hostAdvanceMicros(BAUD_CONFIRM_TIMEOUT * 1000UL);
+   CHECK(exchange("") == fallback);
+   CHECK(Serial.getBaudRate() == SERIAL_BAUD);
+
+   CHECK(exchange("#4 SET_BAUD 57600\n") == "#4 ACK SET_BAUD\r\n#4 DONE SET_BAUD\r\n");
+   CHECK(exchange("KEEP_BAUD\n") == "ACK KEEP_BAUD\r\nDONE KEEP_BAUD\r\n");
+   hostAdvanceMicros(BAUD_CONFIRM_TIMEOUT * 1000UL);
+   CHECK(exchange("GET_ID\n") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(Serial.getBaudRate() == 57600);
+
+   CHECK(exchange("SET_BAUD 1234\n") ==
+         "ACK SET_BAUD\r\nERROR: Unsupported baud rate, see GET_BAUD_RATES\r\nDONE SET_BAUD\r\n");
+   CHECK(Serial.getBaudRate() == 57600);
+ }
+
+ // Values exchanged with the callbacks registered by the tests
+ static int32_t movedTo[MAX_ARGUMENTS];
+ static int32_t position[MAX_ARGUMENTS] = {1250, -500, 100000};
+ static int32_t speed = 0;
+ static CommandParser::CompletionToken pendingCheck;
+
+ void moveInts(int32_t& x, int32_t& y, int32_t& z) {
+   movedTo[0] = x;
+   movedTo[1] = y;
+   movedTo[2] = z;
+ }
+
+ void getPositionInts(int32_t& x, int32_t& y, int32_t& z) {
+   x = position[0];
+   y = position[1];
+   z = position[2];
+ }
+
+ void setSpeedInt(int32_t& value) {
+   speed = value;
+ }
+
+ void getSpeedInt(int32_t& value) {
+   value = speed;
+ }
+
+ void checkLater() {
+   pendingCheck = parser.defer();
+ }
+
+ void getMinSpeedDeferred(int32_t& value) {
+   pendingCheck = parser.defer();  // Not allowed, the DONE carries the value
+   value = 1000;
+ }
+
+ #if !COMMAND_PARSER_FIXED_POINT
+ static float movedBy[MAX_ARGUMENTS];
+
+ void moveFloats(float& x, float& y, float& z) {
+   movedBy[0] = x;
+   movedBy[1] = y;
+   movedBy[2] = z;
+ }
+
+ void getMaxSpeedFloat(float& value) {
+   value = 1234.4f;
+ }
+ #endif
+
+ /**
+  * Checks that the arguments reach the callbacks in fixed point, rounded to
+  * FIXED_POINT_DECIMALS, and the returned values are printed with the
+  * decimals of the command. Float callbacks are checked too unless the
+  * library is built with COMMAND_PARSER_FIXED_POINT.
+  */
+ static void testCallbacks() {
+   CHECK(!parser.on(CommandParser::CMD_SET_SPEED, moveInts));  // Takes one value, not three
+   CHECK(!parser.on(CommandParser::CMD_GET_ID, checkLater));   // Built-in command
+   CHECK(parser.on(CommandParser::CMD_ABSOLUTE_MOVE, moveInts));
+   CHECK(parser.on(CommandParser::CMD_GET_POSITION, getPositionInts));
+   CHECK(parser.on(CommandParser::CMD_SET_SPEED, setSpeedInt));
+   CHECK(parser.on(CommandParser::CMD_GET_SPEED, getSpeedInt));
+
+   CHECK(exchange("ABSOLUTE_MOVE 1.5 -0.0005 2e3\n") == "ACK ABSOLUTE_MOVE\r\nDONE ABSOLUTE_MOVE\r\n");
+   CHECK(movedTo[0] == 1500 && movedTo[1] == -1 && movedTo[2] == 2000000);
+   CHECK(exchange("ABSOLUTE_MOVE 1 2 3000000\n") ==
+         "ACK ABSOLUTE_MOVE\r\nERROR: Number out of range - Argument 3, character 1 - Usage: ABSOLUTE_MOVE x y z\r\n"
+         "DONE ABSOLUTE_MOVE\r\n");
+   CHECK(movedTo[0] == 1500);  // Not called
+   CHECK(exchange("SET_SPEED 12.3456\n") == "ACK SET_SPEED\r\nDONE SET_SPEED\r\n");
+   CHECK(speed == 12346);
+   CHECK(exchange("SET_SPEED -1\n") ==
+         "ACK SET_SPEED\r\nERROR: Values must be positive - Usage: SET_SPEED speed\r\nDONE SET_SPEED\r\n");
+   CHECK(exchange("GET_SPEED\n") == "ACK GET_SPEED\r\nDONE GET_SPEED: 12\r\n");
+   CHECK(exchange("#8 GET_POSITION\n") == "#8 ACK GET_POSITION\r\n#8 DONE GET_POSITION: 1.25 -0.50 100.00\r\n");
+
+ #if !COMMAND_PARSER_FIXED_POINT
+   CHECK(parser.on(CommandParser::CMD_DELTA_MOVE, moveFloats));
+   CHECK(parser.on(CommandParser::CMD_GET_MAX_SPEED, getMaxSpeedFloat));
+   CHECK(exchange("DELTA_MOVE 0.1 -2 1e3\n") == "ACK DELTA_MOVE\r\nDONE DELTA_MOVE\r\n");
+   CHECK(movedBy[0] == 0.1f && movedBy[1] == -2 && movedBy[2] == 1000);
+   CHECK(exchange("GET_MAX_SPEED\n") == "ACK GET_MAX_SPEED\r\nDONE GET_MAX_SPEED: 1234\r\n");
+ #endif
+ }
+
+ /**
+  * Helper function to build a command frame, [command][tag][payload][CRC],
+  * COBS encoded and with its delimiter.
+  *
+  * @param id The command
+  * @param tag The tag, COMMAND_NO_TAG for none
+  * @param payload The arguments, already little endian
+  * @param length Number of bytes in the payload
+  * @return The frame
+  */
+ static std::string commandFrame(uint8_t id, uint16_t tag, const uint8_t* payload = nullptr, size_t length = 0) {
+   uint8_t frame[1 + FRAME_BUFFER_SIZE + 1];
+   frame[1] = id;
+   frame[2] = tag & 0xFF;
+   frame[3] = tag >> 8;
+   if (length > 0) {
+     memcpy(frame + 4, payload, length);
+   }
+   uint16_t crc = FrameCodec::crc16(frame + 1, 3 + length);
+   frame[4 + length] = crc & 0xFF;
+   frame[5 + length] = crc >> 8;
+   return std::string((const char*)frame, FrameCodec::encode(frame, 5 + length));
+ }
+
+ /**
+  * Helper function to store an int32 in a frame payload, little endian.
+  *
+  * @param bytes Where the 4 bytes are written
+  * @param value The value
+  */
+ static void putValue(uint8_t* bytes, int32_t value) {
+   for (uint8_t i = 0; i < 4; i++) {
+     bytes[i] = (uint32_t)value >> (8 * i);
+   }
+ }
+
+ /**
+  * Helper function to decode the frames sent by the parser. Every frame must
+  * decode and pass its CRC.
+  *
+  * @param output The bytes sent
+  * @return The contents of each frame, without its CRC
+  */
+ static std::vector<std::string> replyFrames(const std::string& output) {
+   std::vector<std::string> frames;
+   size_t start = 0;
+   for (size_t end = output.find('\0'); end != std::string::npos; end = output.find('\0', start)) {
+     std::string frame = output.substr(start, end - start);
+     int length = FrameCodec::decode((uint8_t*)&frame[0], frame.size());
+     CHECK(length >= 6);
+     if (length >= 6) {
+       const uint8_t* bytes = (const uint8_t*)frame.data();
+       CHECK(FrameCodec::crc16(bytes, length - 2) == (bytes[length - 2] | bytes[length - 1] << 8));
+       frames.push_back(frame.substr(0, length - 2));
+     }
+     start = end + 1;
+   }
+   CHECK(start == output.size());
+   return frames;
+ }
+
+ /**
+  * Helper function to build the expected start of a reply frame.
+  *
+  * @param kind FRAME_ACK, FRAME_DONE, FRAME_POINT or FRAME_SAMPLE
+  * @param tag The tag of the command
+  * @param id The command
+  * @return The kind, the tag and the command
+  */
+ static std::string reply(uint8_t kind, uint16_t tag, uint8_t id) {
+   const char bytes[] = {(char)kind, (char)(tag & 0xFF), (char)(tag >> 8), (char)id};
+   return std::string(bytes, sizeof(bytes));
+ }
+
+ /**
+  * Helper function to build the expected contents of a FRAME_TEXT frame.
+  *
+  * @param tag The tag of the command
+  * @param text The line, without "\r\n"
+  * @return The contents
+  */
+ static std::string textReply(uint16_t tag, const char* text) {
+   const char bytes[] = {(char)FRAME_TEXT, (char)(tag & 0xFF), (char)(tag >> 8)};
+   return std::string(bytes, sizeof(bytes)) + text;
+ }
+
+ /**
+  * Helper function to build the expected int32 values of a reply frame.
+  *
+  * @param values The values
+  * @param count Number of values
+  * @return The values, little endian
+  */
+ static std::string replyValues(const int32_t* values, uint8_t count) {
+   uint8_t bytes[MAX_ARGUMENTS * 4];
+   for (uint8_t i = 0; i < count; i++) {
+     putValue(bytes + i * 4, values[i]);
+   }
+   return std::string((const char*)bytes, count * 4);
+ }
+
+ /**
+  * Checks that frames run the same commands as lines, with their replies as
+  * frames, and that damaged or malformed frames are rejected.
+  */
+ static void testBinary() {
+   CHECK(exchange("BINARY\n") == "ACK BINARY\r\nDONE BINARY\r\n");
+   CHECK(parser.isBinaryMode());
+
+   std::vector<std::string> replies = replyFrames(exchange(commandFrame(CommandParser::CMD_GET_ID, 7)));
+   CHECK(replies.size() == 2);
+   CHECK(replies.size() == 2 && replies[0] == reply(FRAME_ACK, 7, CommandParser::CMD_GET_ID));
+   CHECK(replies.size() == 2 && replies[1] == reply(FRAME_DONE, 7, CommandParser::CMD_GET_ID) + DEVICE_ID);
+
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_GET_POSITION, COMMAND_NO_TAG)));
+   CHECK(replies.size() == 2 && replies[1] == reply(FRAME_DONE, COMMAND_NO_TAG, CommandParser::CMD_GET_POSITION) +
+                                              replyValues(position, MAX_ARGUMENTS));
+
+   uint8_t payload[MAX_ARGUMENTS * 4];
+   const int32_t target[] = {-2500, 0, 7};
+   for (uint8_t i = 0; i < MAX_ARGUMENTS; i++) {
+     putValue(payload + i * 4, target[i]);
+   }
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_ABSOLUTE_MOVE, 0x0100, payload, sizeof(payload))));
+   CHECK(replies.size() == 2 && replies[1] == reply(FRAME_DONE, 0x0100, CommandParser::CMD_ABSOLUTE_MOVE));
+   CHECK(movedTo[0] == -2500 && movedTo[1] == 0 && movedTo[2] == 7);
+
+   // A payload of the wrong length and a value that must be positive
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_SET_SPEED, 3, payload, 3)));
+   CHECK(replies.size() == 3 && replies[1] == textReply(3, "ERROR: Invalid payload length"));
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_SET_SPEED, 3, payload, 4)));
+   CHECK(replies.size() == 3 && replies[1] == textReply(3, "ERROR: Values must be positive - Usage: SET_SPEED speed"));
+   CHECK(replies.size() == 3 && replies[2] == reply(FRAME_DONE, 3, CommandParser::CMD_SET_SPEED));
+
+   // A frame that fails its CRC is not run, and its tag is not trusted
+   std::string damaged = commandFrame(CommandParser::CMD_GET_ID, 0x0107);
+   damaged[2] ^= 0x10;
+   replies = replyFrames(exchange(damaged));
+   CHECK(replies.size() == 1 && replies[0] == textReply(COMMAND_NO_TAG, "ERROR: Invalid frame"));
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_COUNT, 4)));
+   CHECK(replies.size() == 1 && replies[0] == textReply(4, "ERROR: Unknown opcode"));
+   CHECK(exchange(std::string(1, FRAME_DELIMITER)) == "");  // Empty frames resynchronize
+
+   // A BINARY frame answers in binary and switches back to text
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_BINARY, 9)));
+   CHECK(replies.size() == 2 && replies[1] == reply(FRAME_DONE, 9, CommandParser::CMD_BINARY));
+   CHECK(!parser.isBinaryMode());
+   CHECK(exchange("GET_ID\n") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+ }
+
+ /**
+  * Checks the position stream, and that samples that can not be sent on
+  * time are dropped and counted instead of being sent late.
+  */
+ static void testStream() {
+   const unsigned long period = 10000;  // 100 Hz
+   CHECK(exchange("#7 STREAM_POSITION 100\n") ==
+         "#7 ACK STREAM_POSITION\r\n#7 DONE STREAM_POSITION\r\n#7 POSITION: 1.25 -0.50 100.00\r\n");
+   CHECK(parser.isStreaming());
+   CHECK(exchange("") == "");
+   hostAdvanceMicros(period);
+   CHECK(exchange("") == "#7 POSITION: 1.25 -0.50 100.00\r\n");
+   CHECK(parser.getDroppedSamples() == 0);
+
+   // read() was not called for ten and a half periods
+   hostAdvanceMicros(period * 10 + period / 2);
+   CHECK(exchange("") == "#7 POSITION: 1.25 -0.50 100.00\r\n");
+   CHECK(parser.getDroppedSamples() == 9);
+
+   // The transmit ring is full when the next sample is due
+   Serial.setWriteRoom(0);
+   uint32_t overflows = parser.getTxStats().overflows;
+   while (parser.getTxStats().overflows == overflows) {
+     parser.reportError(F("Filling the transmit ring"));
+   }
+   hostAdvanceMicros(period);
+   parser.read();
+   CHECK(parser.getDroppedSamples() == 10);
+   Serial.setWriteRoom(4096);
+   exchange("");
+
+   CHECK(exchange("STOP_STREAM\n") == "ACK STOP_STREAM\r\nDONE STOP_STREAM: 10\r\n");
+   CHECK(!parser.isStreaming());
+   hostAdvanceMicros(period);
+   CHECK(exchange("") == "");
+
+   CHECK(exchange("STREAM_POSITION 1001\n") ==
+         "ACK STREAM_POSITION\r\nERROR: Stream rate out of range\r\nDONE STREAM_POSITION\r\n");
+   CHECK(!parser.isStreaming());
+ }
+
+ /**
+  * Checks that a deferred command sends its DONE when it is completed, while
+  * other commands keep running, and that only commands without returned
+  * values can be deferred.
+  */
+ static void testDefer() {
+   CHECK(!parser.defer().pending());  // Outside a callback
+   CHECK(parser.on(CommandParser::CMD_CHECK_ERRORS, checkLater));
+   CHECK(exchange("#3 CHECK_ERRORS\n") == "#3 ACK CHECK_ERRORS\r\n");
+   CHECK(pendingCheck.pending());
+   CHECK(exchange("GET_ID\n") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+   CHECK(parser.complete(pendingCheck));
+   CHECK(!pendingCheck.pending());
+   CHECK(exchange("") == "#3 DONE CHECK_ERRORS\r\n");
+   CHECK(parser.complete(pendingCheck));  // Already sent, does nothing
+   CHECK(exchange("") == "");
+
+   // The ring is full, the token is kept to try again
+   CHECK(exchange("CHECK_ERRORS\n") == "ACK CHECK_ERRORS\r\n");
+   Serial.setWriteRoom(0);
+   uint32_t overflows = parser.getTxStats().overflows;
+   while (parser.getTxStats().overflows == overflows) {
+     parser.reportError(F("Filling the transmit ring"));
+   }
+   CHECK(!parser.complete(pendingCheck));
+   CHECK(pendingCheck.pending());
+   Serial.setWriteRoom(4096);
+   exchange("");
+   CHECK(parser.complete(pendingCheck));
+   CHECK(exchange("") == "DONE CHECK_ERRORS\r\n");
+
+   CHECK(parser.on(CommandParser::CMD_GET_MIN_SPEED, getMinSpeedDeferred));
+   CHECK(exchange("GET_MIN_SPEED\n") == "ACK GET_MIN_SPEED\r\nDONE GET_MIN_SPEED: 1\r\n");
+   CHECK(!pendingCheck.pending());
+ }
+
+ /**
+  * Checks GET_STATS, which needs COMMAND_PARSER_STATS.
+  */
+ static void testStats() {
+ #if COMMAND_PARSER_STATS
+   parser.resetCommandStats();
+   CHECK(exchange("GET_ID\n") == "ACK GET_ID\r\nDONE GET_ID: CX25F7TK9P\r\n");
+   std::string stats = exchange("#2 GET_STATS\n");
+   const std::string ack = "#2 ACK GET_STATS\r\n";
+   const std::string done = "#2 DONE GET_STATS\r\n";
+   CHECK(stats.compare(0, ack.size(), ack) == 0);
+   CHECK(stats.size() >= done.size() && stats.compare(stats.size() - done.size(), done.size(), done) == 0);
+   // The host clock did not advance, so every time is in the first bucket
+   CHECK(stats.find("#2 STATS GET_ID RECEIVE 0: 1\r\n#2 STATS GET_ID RUN 0: 1\r\n") != std::string::npos);
+   CHECK(stats.find("STATS ABSOLUTE_MOVE") == std::string::npos);
+   CHECK(parser.getCommandStats().histogram(CommandParser::CMD_GET_ID, CommandStats::STATS_RUN)[0] == 1);
+ #else
+   CHECK(exchange("GET_STATS\n") ==
+         "ACK GET_STATS\r\nERROR: Statistics disabled, build with COMMAND_PARSER_STATS=1\r\nDONE GET_STATS\r\n");
+ #endif
+ }
+
+ /**
+  * Checks that the ACK of every command reports the free depth of the motion
+  * queue, that a move that does not fit is rejected, and that PATH batches
+  * are queued whole and reply once per batch or once per point.
+  */
+ static void testMotionQueue() {
+   parser.useMotionQueue(true);
+   const std::string free = std::to_string(MOTION_QUEUE_DEPTH - 1);
+   CHECK(exchange("#1 ABSOLUTE_MOVE 1 2.5 -3\n") == "#1 ACK ABSOLUTE_MOVE: " + free + "\r\n");
+   CHECK(movedTo[0] == -2500);  // Queued, not run by the callback
+   const MotionCommand* move = parser.currentMove();
+   CHECK(move != nullptr && move->command == CommandParser::CMD_ABSOLUTE_MOVE && move->tag == 1);
+   CHECK(move != nullptr && move->values[0] == 1000 && move->values[1] == 2500 && move->values[2] == -3000);
+   CHECK(exchange("GET_ID\n") == "ACK GET_ID: " + free + "\r\nDONE GET_ID: CX25F7TK9P\r\n");
+   // A rejected move reports the depth it found
+   CHECK(exchange("DELTA_MOVE 1 x 0\n") ==
+         "ACK DELTA_MOVE: " + free + "\r\n"
+         "ERROR: Invalid number format - Argument 2, character 1 - Usage: DELTA_MOVE dx dy dz\r\nDONE DELTA_MOVE\r\n");
+   while (parser.getMotionQueue().free() > 0) {
+     exchange("GO_HOME\n");
+   }
+   CHECK(exchange("DELTA_MOVE 1 0 0\n") == "ACK DELTA_MOVE: 0\r\nERROR: Motion queue full\r\nDONE DELTA_MOVE\r\n");
+   CHECK(parser.finishMove());
+   CHECK(exchange("") == "#1 DONE ABSOLUTE_MOVE\r\n");
+   CHECK(parser.finishMove());
+   CHECK(exchange("") == "DONE GO_HOME\r\n");
+   while (parser.finishMove()) {
+   }
+   CHECK(parser.currentMove() == nullptr);
+   exchange("");
+
+   CHECK(exchange("PATH\n") ==
+         "ACK PATH: " + std::to_string(MOTION_QUEUE_DEPTH) + "\r\n"
+         "ERROR: PATH is only accepted as a binary frame\r\nDONE PATH\r\n");
+
+   // Batches of three points, which fit in the receive buffer of any build
+   uint8_t payload[1 + 3 * MOTION_AXES * 4];
+   payload[0] = PATH_REPORT_POINTS;
+   for (uint8_t i = 0; i < 3 * MOTION_AXES; i++) {
+     putValue(payload + 1 + i * 4, (i + 1) * 1000);
+   }
+
+   // A batch that does not fit is rejected whole
+   while (parser.getMotionQueue().free() > 2) {
+     exchange("GO_HOME\n");
+   }
+   CHECK(exchange("BINARY\n") == "ACK BINARY: 2\r\nDONE BINARY\r\n");
+   std::vector<std::string> replies = replyFrames(exchange(commandFrame(CommandParser::CMD_PATH, 6, payload,
+                                                                        sizeof(payload))));
+   CHECK(replies.size() == 3 && replies[0] == reply(FRAME_ACK, 6, CommandParser::CMD_PATH) + '\2');
+   CHECK(replies.size() == 3 && replies[1] == textReply(6, "ERROR: Motion queue full"));
+   CHECK(replies.size() == 3 && replies[2] == reply(FRAME_DONE, 6, CommandParser::CMD_PATH));
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_PATH, 6, payload, 1 + MOTION_AXES * 4 - 1)));
+   CHECK(replies.size() == 3 && replies[1] == textReply(6, "ERROR: Invalid payload length"));
+   CHECK(parser.getMotionQueue().free() == 2);
+   while (parser.finishMove()) {
+   }
+   replyFrames(exchange(""));
+
+   // Three points that report each one
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_PATH, 5, payload, sizeof(payload))));
+   CHECK(replies.size() == 1 && replies[0] == reply(FRAME_ACK, 5, CommandParser::CMD_PATH) +
+                                              (char)(MOTION_QUEUE_DEPTH - 3));
+   CHECK(parser.getMotionQueue().size() == 3);
+   move = parser.currentMove();
+   CHECK(move != nullptr && move->command == CommandParser::CMD_ABSOLUTE_MOVE && move->values[2] == 3000);
+   CHECK(parser.getMotionQueue().at(2) != nullptr && parser.getMotionQueue().at(2)->values[0] == 7000);
+
+   CHECK(parser.finishMove());
+   replies = replyFrames(exchange(""));
+   CHECK(replies.size() == 1 && replies[0] == reply(FRAME_POINT, 5, CommandParser::CMD_PATH) + '\0');
+
+   // The other points reply in text once back in text mode
+   replyFrames(exchange(commandFrame(CommandParser::CMD_BINARY, COMMAND_NO_TAG)));
+   CHECK(parser.finishMove());
+   CHECK(exchange("") == "#5 POINT PATH: 1\r\n");
+   CHECK(parser.finishMove());
+   CHECK(exchange("") == "#5 DONE PATH\r\n");
+   CHECK(!parser.finishMove());
+
+   // Without the reports a batch only sends its DONE
+   payload[0] = 0;
+   exchange("BINARY\n");
+   replyFrames(exchange(commandFrame(CommandParser::CMD_PATH, 2, payload, 1 + 2 * MOTION_AXES * 4)));
+   CHECK(parser.finishMove());
+   CHECK(exchange("") == "");
+   CHECK(parser.finishMove());
+   replies = replyFrames(exchange(""));
+   CHECK(replies.size() == 1 && replies[0] == reply(FRAME_DONE, 2, CommandParser::CMD_PATH));
+   replyFrames(exchange(commandFrame(CommandParser::CMD_BINARY, COMMAND_NO_TAG)));
+
+   parser.useMotionQueue(false);
+   CHECK(exchange("BINARY\n") == "ACK BINARY\r\nDONE BINARY\r\n");
+   replies = replyFrames(exchange(commandFrame(CommandParser::CMD_PATH, 2, payload, 1 + MOTION_AXES * 4)));
+   CHECK(replies.size() == 3 && replies[1] == textReply(2, "ERROR: PATH needs the motion queue"));
+   replyFrames(exchange(commandFrame(CommandParser::CMD_BINARY, COMMAND_NO_TAG)));
+   CHECK(!parser.isBinaryMode());
+ }
+
+ int main() {
+   testNumbers();
+   testFrames();
+   testTxBuffer();
+   testLines();
+   testBaud();
+   testCallbacks();
+   testBinary();
+   testStream();
+   testDefer();
+   testStats();
+   testMotionQueue();
+   return checkResult();
+ }
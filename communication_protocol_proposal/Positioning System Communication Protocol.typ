@@ -46,10 +46,19 @@ La comunicación se realiza a través del puerto serial con los siguientes pará
     [*Parámetro*], [*Valor*],
     [Baud Rate], [115200],
     [Timeout], [50 ms],
-    [Buffer de Comandos], [64 bytes],
+    [Buffer de Comandos], [104 bytes (configurable)],
   )
 ]
 
+=== Cambio de Velocidad
+
+La velocidad se puede subir en funcionamiento con un intercambio en dos fases, para que un error nunca deje al host y al dispositivo hablando a velocidades distintas:
+
++ El host envía `SET_BAUD rate` a la velocidad actual. El dispositivo responde `ACK` y `DONE` a esa velocidad y después cambia a la nueva.
++ El host cambia a la nueva velocidad y envía `KEEP_BAUD`. El dispositivo responde `ACK KEEP_BAUD` y `DONE KEEP_BAUD` y la nueva velocidad queda fija.
+
+Si `KEEP_BAUD` no llega en `BAUD_CONFIRM_TIMEOUT` ms (1000), el dispositivo vuelve a la velocidad anterior y envía `ERROR: Baud rate not kept, back to the previous rate`; el host debe hacer lo mismo si no recibe `DONE KEEP_BAUD`. Al cambiar de velocidad, el dispositivo descarta lo que queda de la línea de `SET_BAUD` y todo lo recibido hasta ese momento, porque llegó a la velocidad anterior; solo cuenta un `KEEP_BAUD` enviado después de recibir `DONE SET_BAUD`. Mientras espera `KEEP_BAUD`, el dispositivo ignora cualquier otro comando sin responder. Las velocidades aceptadas se consultan con `GET_BAUD_RATES`; en AVR son las que un reloj de 16 MHz genera con poco error, hasta 2000000.
+
 == Estructura General de los Comandos
 
 Todos los comandos siguen la siguiente estructura:
@@ -61,8 +70,10 @@ COMANDO [parámetro1] [parámetro2] ... [parámetroN]
 Características importantes:
 - Los comandos no distinguen entre mayúsculas y minúsculas (se convierten a mayúsculas internamente), sin embargo el uso de mayúsculas es recomendado para distinguir los comandos de otros strings.
 - Los espacios en blanco al inicio y al final son eliminados automáticamente.
-- Los comandos deben terminar con un carácter de nueva línea (`\n` o `\r`).
-- La longitud máxima de un comando (incluyendo parámetros) es de 63 caracteres.
+- Los comandos deben terminar con un carácter de nueva línea (`\n` o `\r`) o con `;`, ver @multiple.
+- La longitud máxima de un comando (incluyendo parámetros) es de 103 caracteres (`COMMAND_PARSER_BUFFER_SIZE` - 1, ver @parser-size).
+- Un comando puede ir precedido de una etiqueta numérica opcional entre `#0` y `#65534` (por ejemplo `#17 ABSOLUTE_MOVE 1 2 3`), ver @tags.
+- Los parámetros numéricos aceptan signo, punto decimal y exponente opcional (por ejemplo `-12.5`, `.5` o `1e-3`). Si un número no es válido, el error indica el parámetro y el carácter donde se detectó.
 
 == Estructura de las Respuestas
 
@@ -83,6 +94,87 @@ ERROR: [mensaje]
 
 Los errores siempre estarán entre un mensaje `ACK` y `DONE` por lo que pueden ser fácilmente asociados al comando al que pertenecen.
 
+Los comandos de movimiento (`GO_HOME`, `ABSOLUTE_MOVE`, `DELTA_MOVE`) pueden responder `DONE` recién al terminar el movimiento. Mientras tanto el dispositivo sigue aceptando comandos, por lo que entre su `ACK` y su `DONE` pueden aparecer las respuestas completas de otros comandos (por ejemplo `GET_POSITION`).
+
+Si el dispositivo usa la cola de movimientos, cada `ACK` indica cuántos movimientos más caben en la cola una vez aceptado el comando, por ejemplo `ACK ABSOLUTE_MOVE: 7`. El host puede enviar movimientos sin esperar su `DONE` mientras este valor sea mayor que cero. Los argumentos se validan antes del `ACK`, así que un movimiento con argumentos inválidos informa los lugares que había y su error llega después del `ACK`. Un movimiento que no cabe se rechaza con `ERROR: Motion queue full` seguido de su `DONE`.
+
+== Comandos Etiquetados <tags>
+
+Si un comando lleva una etiqueta, todas las líneas `ACK`, `ERROR` y `DONE` de su respuesta la repiten al inicio, incluso cuando el `DONE` llega después de las respuestas de otros comandos:
+
+```
+#17 ABSOLUTE_MOVE 1 2 3
+#18 GET_POSITION
+```
+```
+#17 ACK ABSOLUTE_MOVE
+#18 ACK GET_POSITION
+#18 DONE GET_POSITION: 0.00 0.00 0.00
+#17 DONE ABSOLUTE_MOVE
+```
+
+Así el host puede enviar varios comandos sin esperar cada respuesta y asociarlas por su etiqueta. Las líneas de ayuda de `HELP` no llevan etiqueta. Una etiqueta mal formada se responde con `ERROR: Invalid tag, use #0 to #65534 before the command` y el comando no se ejecuta.
+
+== Varios Comandos por Línea <multiple>
+
+Una línea puede llevar varios comandos separados por `;`, que se ejecutan en orden como si llegaran en líneas separadas, cada uno con su `ACK`, sus errores y su `DONE`:
+
+```
+#1 SET_SPEED 5; #2 ABSOLUTE_MOVE 1 2 3; GET_POSITION
+```
+```
+#1 ACK SET_SPEED
+#1 DONE SET_SPEED
+#2 ACK ABSOLUTE_MOVE
+#2 DONE ABSOLUTE_MOVE
+ACK GET_POSITION
+DONE GET_POSITION: 1.00 2.00 3.00
+```
+
+Los comandos se procesan en la misma llamada a `read()` mientras el buffer de transmisión tenga lugar para la respuesta completa de cada uno (`TX_RESPONSE_SIZE` bytes, ver Buffer de Transmisión), y sus respuestas se envían juntas, por lo que una secuencia corta cuesta una sola transferencia en cada sentido. Si la UART no alcanza a vaciar el buffer, los comandos restantes quedan en el buffer de entrada del puerto serial y se procesan en las siguientes llamadas a `read()`, en el mismo orden. Un error en un comando no impide ejecutar los siguientes, y el límite de longitud se aplica a cada comando por separado.
+
+== Telemetría de Posición <stream>
+
+`STREAM_POSITION hz` hace que el dispositivo envíe su posición `hz` veces por segundo (hasta `STREAM_MAX_RATE`, 1000), sin que el host la pida, hasta recibir `STOP_STREAM`. Cada muestra es una línea con la etiqueta del comando que inició el envío:
+
+```
+#7 STREAM_POSITION 50
+```
+```
+#7 ACK STREAM_POSITION
+#7 DONE STREAM_POSITION
+#7 POSITION: 1.00 2.00 3.00
+#7 POSITION: 1.02 2.00 3.00
+...
+```
+
+En modo binario cada muestra es una trama de 20 bytes. Las muestras siguen un horario fijo: las que no se pueden enviar a tiempo, porque el buffer de transmisión está lleno o `read()` no se llamó durante el período, se descartan y se cuentan en vez de enviarse tarde. `STOP_STREAM` responde con ese contador (`DONE STOP_STREAM: 3`).
+
+== Modo Binario <binary>
+
+El comando `BINARY` cambia la comunicación a tramas binarias, con los mismos comandos y respuestas pero sin texto. Se responde en texto (`ACK BINARY` y `DONE BINARY`) y a partir de ahí el dispositivo sólo acepta tramas; una trama `BINARY` responde en binario y vuelve al modo texto.
+
+Cada trama se codifica con COBS y termina con un byte `0x00`, que no aparece en ningún otro lugar de la trama, por lo que un byte perdido sólo invalida una trama. Antes de codificar, todos los campos son little endian:
+
+#align(center)[
+  #table(
+    columns: (auto, auto),
+    inset: 10pt,
+    align: (left, left),
+    [*Trama*], [*Contenido*],
+    [Comando], [`[comando][etiqueta, 2 bytes][parámetros, int32][CRC16, 2 bytes]`],
+    [`ACK` (0x80)], [`[0x80][etiqueta][comando]`, más los lugares libres de la cola si se usa],
+    [`DONE` (0x81)], [`[0x81][etiqueta][comando]`, más los valores devueltos en int32 o el texto de `GET_ID`],
+    [Texto (0x82)], [`[0x82][etiqueta][línea sin "\r\n"]`, para los errores y la ayuda],
+    [`POINT` (0x83)], [`[0x83][etiqueta][PATH][índice]`, punto terminado de un `PATH` que lo pidió],
+    [Muestra (0x84)], [`[0x84][etiqueta][STREAM_POSITION][x y z]`, posición enviada por `STREAM_POSITION`],
+  )
+]
+
+El comando es su posición en la Referencia Rápida, empezando en 0 (`HELP` = 0, `ABSOLUTE_MOVE` = 3, `BINARY` = 12). Los valores van en punto fijo con tres decimales (1.5 mm se envía como 1500); un valor devuelto que no cabe en int32 se satura al mayor o menor int32. La etiqueta 0xFFFF indica un comando sin etiqueta. El CRC16 es CCITT (polinomio 0x1021, valor inicial 0xFFFF) sobre todos los bytes anteriores. Una trama con el CRC incorrecto se responde con el error `Invalid frame` y no se ejecuta.
+
+Un movimiento etiquetado ocupa 19 bytes de comando y 8 bytes por cada `ACK` y `DONE`, unos 35 bytes en total frente a unos 75 en texto, sin conversión de números en ninguno de los dos extremos. Con `PATH` un lote de 8 puntos ocupa 121 bytes, unos 15 bytes por punto.
+
 #pagebreak()
 
 = Comandos del Protocolo <comandos>
@@ -325,6 +417,157 @@ DONE CHECK_ERRORS
   ],
 )
 
+== Comando BINARY
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`BINARY`],
+  [*Parámetros:*], [Ninguno],
+  [*Descripción:*], [Cambia al modo binario (ver @binary). Enviado como trama, vuelve al modo texto.],
+  [*Respuesta:*], [
+```
+ACK BINARY
+DONE BINARY
+```
+A partir de esta respuesta las dos partes usan tramas binarias.
+  ],
+)
+
+== Comando SET_BAUD
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`SET_BAUD rate`],
+  [*Parámetros:*], [
+    - `rate`: Velocidad en baudios, una de las de `GET_BAUD_RATES`
+  ],
+  [*Descripción:*], [Cambia la velocidad del puerto serial después de responder. Debe seguirle `KEEP_BAUD` a la nueva velocidad.],
+  [*Respuesta:*], [
+```
+ACK SET_BAUD
+[ERROR: Unsupported baud rate, see GET_BAUD_RATES] (Si la velocidad no es válida)
+DONE SET_BAUD
+```
+  ],
+)
+
+== Comando KEEP_BAUD
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`KEEP_BAUD`],
+  [*Parámetros:*], [Ninguno],
+  [*Descripción:*], [Confirma la velocidad fijada por `SET_BAUD`. Sin él, el dispositivo vuelve a la velocidad anterior.],
+  [*Respuesta:*], [
+```
+ACK KEEP_BAUD
+DONE KEEP_BAUD
+```
+  ],
+)
+
+== Comando GET_BAUD_RATES
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`GET_BAUD_RATES`],
+  [*Parámetros:*], [Ninguno],
+  [*Descripción:*], [Devuelve las velocidades que acepta `SET_BAUD`.],
+  [*Respuesta:*], [
+```
+ACK GET_BAUD_RATES
+DONE GET_BAUD_RATES: 9600 19200 38400 57600 115200 250000 500000 1000000 2000000
+```
+En modo binario cada velocidad es un uint32.
+  ],
+)
+
+== Comando STREAM_POSITION
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`STREAM_POSITION hz`],
+  [*Parámetros:*], [
+    - `hz`: Muestras por segundo, mayor que 0 y hasta 1000 (admite decimales, por ejemplo 0.5)
+  ],
+  [*Descripción:*], [Envía la posición actual `hz` veces por segundo hasta `STOP_STREAM` (ver @stream). Un nuevo `STREAM_POSITION` cambia la frecuencia.],
+  [*Respuesta:*], [
+```
+ACK STREAM_POSITION
+[ERROR: error_description] (Si hay errores)
+DONE STREAM_POSITION
+POSITION: x y z (Cada 1/hz segundos)
+```
+  ],
+)
+
+== Comando STOP_STREAM
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`STOP_STREAM`],
+  [*Parámetros:*], [Ninguno],
+  [*Descripción:*], [Detiene el envío de la posición y devuelve el número de muestras descartadas.],
+  [*Respuesta:*], [
+```
+ACK STOP_STREAM
+DONE STOP_STREAM: dropped
+```
+  ],
+)
+
+== Comando PATH
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [Trama binaria `[PATH][etiqueta][opciones][x y z]...`],
+  [*Parámetros:*], [
+    - `opciones`: un byte; con el bit 0 en 1 se informa cada punto terminado
+    - Hasta `PATH_MAX_POINTS` puntos (8 por defecto), cada uno `x y z` en int32 de punto fijo
+  ],
+  [*Descripción:*], [Agrega un lote de movimientos absolutos a la cola de movimientos en un solo mensaje. El lote se agrega completo o se rechaza completo (`Motion queue full` si no cabe), y requiere `useMotionQueue(true)`. Sólo se acepta en modo binario.],
+  [*Respuesta:*], [
+```
+ACK PATH (con los lugares libres de la cola)
+[POINT PATH: índice] (Por cada punto terminado, si se pidió)
+DONE PATH (Al terminar el último punto)
+```
+  ],
+)
+
+== Comando GET_STATS
+
+#table(
+  columns: (auto, 1fr),
+  inset: 10pt,
+  stroke: 0.5pt,
+  [*Formato:*], [`GET_STATS`],
+  [*Parámetros:*], [Ninguno],
+  [*Descripción:*], [Devuelve los histogramas de latencia de cada comando (ver @stats). Sólo está disponible si la librería se compila con `COMMAND_PARSER_STATS`; si no, responde con un error.],
+  [*Respuesta:*], [
+```
+ACK GET_STATS
+STATS comando RECEIVE primero: n n ... (Por cada histograma no vacío)
+STATS comando RUN primero: n n ...
+DONE GET_STATS
+```
+  ],
+)
+
 #pagebreak()
 
 = Referencia Rápida de Comandos
@@ -347,6 +590,14 @@ DONE CHECK_ERRORS
     [GET_MAX_SPEED], [Obtiene la velocidad máxima],
     [GET_ID], [Obtiene el identificador único del dispositivo (CX25F7TK9P)],
     [CHECK_ERRORS], [Diagnostica errores],
+    [BINARY], [Cambia entre el modo texto y el modo binario],
+    [PATH], [Lote de movimientos absolutos (sólo en modo binario)],
+    [SET_BAUD rate], [Cambia la velocidad del puerto serial],
+    [KEEP_BAUD], [Confirma la nueva velocidad],
+    [GET_BAUD_RATES], [Obtiene las velocidades soportadas],
+    [STREAM_POSITION hz], [Envía la posición periódicamente],
+    [STOP_STREAM], [Detiene el envío de la posición],
+    [GET_STATS], [Obtiene los histogramas de latencia de los comandos],
   )
 ]
 
@@ -368,6 +619,18 @@ La librería está organizada de la siguiente manera:
     [*Archivo*], [*Descripción*],
     [CommandParser.h], [Archivo de cabecera que contiene las definiciones de la clase.],
     [CommandParser.cpp], [Implementación de la clase CommandParser.],
+    [CommandList.h], [Lista única de los comandos (nombre, parámetros, ayuda), de la que se generan los identificadores y la tabla.],
+    [CommandTable.h], [Tabla con la descripción de cada comando, almacenada en memoria flash.],
+    [CommandStats.h/.cpp], [Histogramas de latencia de cada comando, enviados con `GET_STATS`.],
+    [NumberParser.h/.cpp], [Conversión de los parámetros numéricos en una sola pasada, sin `atof()`.],
+    [NumberFormatter.h/.cpp], [Conversión de números a texto para las respuestas, sin divisiones.],
+    [FrameCodec.h/.cpp], [Codificación COBS y CRC16 de las tramas del modo binario.],
+    [MotionQueue.h/.cpp], [Cola de movimientos pendientes entre el parser y el ejecutor de movimientos.],
+    [MotionPlanner.h/.cpp], [Planificador que calcula las velocidades de unión entre los movimientos de la cola.],
+    [MotionProfile.h/.cpp], [Perfiles de velocidad trapezoidal y curva S en punto fijo para seguir cada movimiento.],
+    [StepEngine.h/.cpp], [Generación de pasos por interrupción de timer, alimentada desde la cola de movimientos.],
+    [host/], [Compilación en Linux con CMake, con un núcleo de Arduino mínimo (no la usa el IDE de Arduino).],
+    [TxBuffer.h/.cpp], [Buffer circular de transmisión, vaciado hacia el puerto serial sin bloquear.],
     [keywords.txt], [Palabras clave para resaltado de sintaxis en el IDE de Arduino.],
   )
 ]
@@ -442,10 +705,303 @@ La librería utiliza un sistema de callbacks para procesar los comandos. El usua
   [checkErrorsCallback], [`void checkErrorsCallback()`]
 )
 
+Los callbacks también se pueden registrar de forma individual con `on()`, indicando el identificador del comando:
+
+```cpp
+parser.on(CommandParser::CMD_ABSOLUTE_MOVE, absoluteMoveCallback);
+parser.on(CommandParser::CMD_GET_SPEED, getSpeedCallback);
+```
+
+`on()` devuelve `false` si la firma del callback no corresponde a la del comando.
+
+Los comandos con valores también aceptan callbacks con enteros de punto fijo, en milésimas de la unidad (micrómetros para posiciones en mm y µm/s para velocidades), lo que evita la aritmética de punto flotante en microcontroladores de 8 bits:
+
+```cpp
+void absoluteMoveCallback(int32_t &x, int32_t &y, int32_t &z);  // micrómetros
+void getSpeedCallback(int32_t &speed);                          // µm/s
+```
+
+Si se define `COMMAND_PARSER_FIXED_POINT` como `1` (por ejemplo con un flag de compilación), la librería sólo acepta callbacks enteros y no enlaza código de punto flotante; en este modo `config()` no está disponible y los callbacks se registran con `on()`.
+
 == Errores en las funciones Callback
 
 Cualquier error dentro de una función callback se debe implementar siguiendo el formato definido en la sección @error-structure. Esto en Arduino se puede lograr mediante el siguiente código:
 ```cpp
-Serial.print("ERROR: ");
-Serial.println(errorMessage);
-```
\ No newline at end of file
+parser.reportError(errorMessage);
+parser.reportError(F("Motor bloqueado"));  // Mensaje almacenado en flash
+```
+
+Se debe usar `reportError()` en lugar de escribir directamente en `Serial`, ya que la respuesta del parser pasa por su propio buffer de transmisión y un mensaje escrito en `Serial` podría aparecer antes del `ACK` del comando. Cada línea de respuesta se compone completa y se envía al buffer con una sola escritura; los mensajes más largos que `RESPONSE_LINE_SIZE` (128 bytes) se recortan.
+
+== Ejecución Asíncrona
+
+Un callback puede iniciar un trabajo largo, como un movimiento, y retornar de inmediato llamando a `defer()`. El parser envía el `ACK` pero no el `DONE`, y `read()` sigue procesando comandos mientras el trabajo continúa. El `DONE` se envía al llamar a `complete()` con el token obtenido:
+
+```cpp
+CommandParser::CompletionToken moveDone;
+
+void absoluteMoveCallback(int32_t &x, int32_t &y, int32_t &z) {
+  startMove(x, y, z);
+  moveDone = parser.defer();
+}
+
+void loop() {
+  parser.read();
+  if (moveDone.pending() && moveFinished()) {
+    parser.complete(moveDone);  // Envía "DONE ABSOLUTE_MOVE"
+  }
+}
+```
+
+Sólo se pueden diferir comandos que no retornan valores. Si el buffer de transmisión está lleno `complete()` retorna `false` y el token sigue pendiente, por lo que basta con volver a llamarlo.
+
+== Cola de Movimientos
+
+Con `useMotionQueue(true)` los comandos `GO_HOME`, `ABSOLUTE_MOVE` y `DELTA_MOVE` no llaman a sus callbacks, sino que se agregan a una cola de `MOTION_QUEUE_DEPTH` movimientos (8 por defecto) con sus valores en punto fijo. El ejecutor de movimientos toma el movimiento más antiguo con `currentMove()` y, al terminarlo, llama a `finishMove()`, que envía su `DONE` y lo quita de la cola:
+
+```cpp
+void loop() {
+  parser.read();
+  const MotionCommand* move = parser.currentMove();
+  if (move != nullptr && !moving) {
+    startMove(move->command, move->values);  // Micrómetros
+    moving = true;
+  }
+  if (moving && moveFinished()) {
+    parser.finishMove();  // Envía "DONE ABSOLUTE_MOVE"
+    moving = false;
+  }
+}
+```
+
+Los puntos de un `PATH` se encolan como `ABSOLUTE_MOVE`, por lo que el ejecutor no los distingue; `finishMove()` envía el `DONE PATH` con el último punto del lote y no responde nada por los demás, salvo que el lote pidiera `POINT`.
+
+== Planificador de Movimientos
+
+Sin planificación, cada movimiento de la cola parte y termina detenido. `MotionPlanner` recorre todos los movimientos encolados y calcula, para cada uno, su velocidad de entrada, de crucero y de salida, de modo que en una trayectoria continua la unión entre dos movimientos se recorre sin detenerse:
+
+- La velocidad en cada unión se limita según el ángulo entre ambos movimientos y la desviación permitida (`PLANNER_DEVIATION`, 0.01 mm por defecto): dos movimientos colineales se unen a velocidad de crucero y una inversión de sentido se detiene.
+- Una pasada hacia atrás y otra hacia adelante aseguran que cada velocidad se pueda alcanzar con la aceleración (`PLANNER_ACCELERATION`, 500 mm/s² por defecto) en el largo de los movimientos. `setAcceleration()` eleva los valores menores que `PLANNER_MIN_ACCELERATION` (1 mm/s²), incluidos 0 y NaN, porque con una aceleración nula las rampas no terminarían nunca.
+- El último movimiento encolado siempre termina detenido, por lo que el plan es seguro aunque no lleguen más movimientos.
+
+El plan se recalcula cada vez que cambia la cola, desde la posición y velocidad con que empieza el movimiento más antiguo:
+
+```cpp
+#include <MotionPlanner.h>
+
+MotionPlanner planner;
+
+void setSpeed(float &speed) {
+  planner.setSpeed(speed);  // Velocidad de crucero en mm/s
+}
+
+void loop() {
+  parser.read();
+  const MotionCommand* move = parser.currentMove();
+  if (move != nullptr && !moving) {
+    planner.plan(parser.getMotionQueue(), startPosition, currentSpeed);
+    const PlannedMove* planned = planner.getMove(0);
+    startMove(move->values, planned->entrySpeed, planned->cruiseSpeed, planned->exitSpeed);
+    moving = true;
+  }
+  ...
+}
+```
+
+El cálculo usa `float` porque se hace una vez por movimiento y no en cada paso del motor.
+
+== Perfil de Velocidad
+
+`MotionProfile` convierte un movimiento planificado en fases de aceleración, crucero y desaceleración. `prepare()` calcula las fases una vez por movimiento y luego `tick()`, llamado `PROFILE_TICK_RATE` veces por segundo (1000 Hz por defecto, típicamente desde la interrupción de un timer), avanza el movimiento con unas pocas sumas enteras:
+
+```cpp
+#include <MotionProfile.h>
+
+MotionProfile profile;
+
+void setup() {
+  profile.setShape(MotionProfile::PROFILE_S_CURVE);  // PROFILE_TRAPEZOID por defecto
+}
+
+void startMove(const MotionCommand* move) {
+  planner.plan(parser.getMotionQueue(), startPosition, currentSpeed);
+  profile.prepare(*planner.getMove(0), planner.getAcceleration());
+}
+
+void onTimer() {  // PROFILE_TICK_RATE veces por segundo
+  if (!profile.tick()) {
+    moveFinished = true;
+  }
+  int32_t distance = profile.getDistance();  // Micrómetros recorridos en el movimiento
+}
+```
+
+Hay dos formas de rampa:
+
+- *Trapezoidal:* la velocidad cambia con aceleración constante.
+- *Curva S:* la aceleración sube de 0 al doble de la aceleración del planificador y vuelve a 0, por lo que la rampa dura lo mismo y recorre la misma distancia que la trapezoidal, pero sin saltos de aceleración.
+
+La velocidad se lleva en punto fijo Q16 (unidades por tick) y la aceleración en Q24; la parte de la aceleración que no llega a un paso Q16 se acumula de un tick al siguiente, por lo que las aceleraciones bajas no se pierden. Las rampas y el crucero se redondean hacia arriba a ticks enteros y para ajustar el largo la velocidad de crucero sólo se reduce, por lo que nunca se superan la velocidad ni la aceleración del planificador. Los errores de redondeo se corrigen al final de cada fase, y el movimiento siempre termina exactamente en su largo.
+
+== Generación de Pasos
+
+`StepEngine` junta la cola, el planificador y el perfil, y genera los pasos de los tres ejes desde la interrupción de un timer, por lo que el tiempo entre pasos no depende de `loop()` ni de los comandos que se estén procesando:
+
+- `update()`, llamado desde `loop()`, toma los movimientos de la cola, los planifica y prepara su perfil con un movimiento de anticipación, y envía el `DONE` de los movimientos terminados con `finishMove()`.
+- `isr()`, llamado `STEP_TICK_RATE` veces por segundo (10000 Hz por defecto), avanza el perfil y reparte los pasos del eje con más pasos en forma pareja; los otros ejes lo siguen con el algoritmo de Bresenham. Da a lo más un paso por llamada, por lo que `STEP_TICK_RATE` es la máxima frecuencia de pasos de un eje.
+
+La interrupción nunca usa el parser y `update()` sólo escribe el movimiento que la interrupción no está ejecutando, por lo que ninguno espera al otro. Si `update()` no alcanza a cargar el siguiente movimiento antes de que termine el actual, los ejes se detienen al final de éste.
+
+```cpp
+#include <StepEngine.h>
+
+StepEngine engine;
+
+ISR(TIMER1_COMPA_vect) {
+  engine.isr();
+}
+
+void step(uint8_t steps, uint8_t directions) {
+  // Bit n de cada máscara corresponde al eje n (x, y, z)
+  PORTD = (PORTD & ~DIRECTION_PINS) | directionBits(directions);
+  PORTD |= stepBits(steps);
+  PORTD &= ~stepBits(steps);
+}
+
+void setSpeed(float &speed) {
+  engine.getPlanner().setSpeed(speed);
+}
+
+void setup() {
+  parser.begin();
+  parser.useMotionQueue(true);
+  parser.on(CommandParser::CMD_SET_SPEED, setSpeed);
+  engine.setStepsPerMm(0, 80);  // STEPS_PER_MM por defecto
+  engine.onStep(step);
+  engine.startTimer();  // Timer1 en AVR; en otras placas se llama a isr() desde otro timer
+}
+
+void loop() {
+  parser.read();
+  engine.update(parser);
+}
+```
+
+La posición de cada eje, en pasos desde home, se obtiene con `getSteps(eje)`, y `setHome()` la deja en cero cuando los ejes están detenidos. En AVR `getSteps()` lee la posición en un `ATOMIC_BLOCK(ATOMIC_RESTORESTATE)`, que restaura el estado de las interrupciones que encontró, así que también se puede llamar con las interrupciones deshabilitadas o desde otra interrupción.
+
+== Buffer de Transmisión
+
+Todas las respuestas se escriben en un buffer circular de `TX_BUFFER_SIZE` bytes (256 por defecto, potencia de dos) que `read()` vacía hacia el puerto serial sólo en la medida que `Serial.availableForWrite()` lo permite, por lo que el procesamiento de un comando nunca espera a la UART. Mientras el buffer no tenga espacio para una respuesta completa (`TX_RESPONSE_SIZE` bytes), `read()` no empieza ni termina ningún comando y deja los bytes recibidos en el buffer de entrada del puerto serial. El espacio se comprueba en el primer y el último byte de cada comando, no en cada byte, y antes de detenerse `read()` vuelve a vaciar el buffer hacia la UART.
+
+Si una respuesta no cabe, por defecto se descarta y se contabiliza; los contadores se consultan con `getTxStats()`:
+
+```cpp
+const TxBuffer::Stats& stats = parser.getTxStats();
+stats.droppedBytes;  // Bytes descartados
+stats.overflows;     // Escrituras que no cupieron
+stats.highWater;     // Máximo de bytes pendientes en el buffer
+```
+
+Con `parser.setOverflowPolicy(TxBuffer::OVERFLOW_BLOCK)` se recupera el comportamiento bloqueante anterior, necesario en placas cuyo núcleo no implementa `availableForWrite()`.
+
+== Estadísticas de Latencia <stats>
+
+Si se define `COMMAND_PARSER_STATS` como `1`, el parser mide con `micros()` tres instantes de cada comando: la recepción de su primer byte (o del `#` de la etiqueta), el envío de su `ACK` y el envío de su `DONE`. Cada comando acumula dos histogramas, `RECEIVE` (de la recepción al `ACK`) y `RUN` (del `ACK` al `DONE`, incluida la espera de un movimiento en la cola). Son histogramas logarítmicos de `STATS_BUCKETS` intervalos (24 por defecto): el intervalo `b` cuenta las latencias de $2^b$ a $2^(b+1) - 1$ µs, el 0 también cuenta 0 µs y el último todas las mayores. Los contadores son de 16 bits y se saturan en 65535.
+
+`GET_STATS` envía una línea por histograma no vacío, desde su primer hasta su último intervalo no vacío, con la etiqueta del comando:
+
+```
+STATS ABSOLUTE_MOVE RECEIVE 9: 14 2
+STATS ABSOLUTE_MOVE RUN 20: 3 11
+```
+
+En este ejemplo 14 `ABSOLUTE_MOVE` tardaron de 512 a 1023 µs desde su primer byte hasta el `ACK`, y 11 tardaron de 2,1 a 4,2 s en terminar. Como la ayuda, las líneas se envían a medida que hay espacio en el buffer de transmisión y no se leen comandos nuevos hasta `DONE GET_STATS`. Desde el programa, los histogramas se leen con `getCommandStats()` y se reinician con `resetCommandStats()`.
+
+Los histogramas ocupan 20 × 2 × `STATS_BUCKETS` × 2 bytes de SRAM (1920 bytes por defecto) y las líneas de respuesta pasan a 192 bytes, por lo que en placas con poca memoria conviene bajar `STATS_BUCKETS` (con 12 intervalos, el último desde 2 ms, ocupan 960 bytes). Sin `COMMAND_PARSER_STATS` no se mide nada y no se reserva memoria.
+
+== Tamaño del Parser <parser-size>
+
+`CommandParser` es un alias de `BasicCommandParser<>`, con un buffer de recepción de `COMMAND_PARSER_BUFFER_SIZE` bytes (104) y lugar para `MAX_ARGUMENTS` argumentos (3), que son también los valores que se intercambian con los callbacks y el máximo que toma un comando. Cada proyecto puede elegir otro tamaño de buffer, que se comprueba al compilar:
+
+```cpp
+BasicCommandParser<32> parser;  // Líneas de hasta 31 caracteres, 72 bytes menos de SRAM
+```
+
+El buffer limita tanto la línea de texto más larga como la trama binaria más larga, por lo que con un buffer pequeño un `PATH` admite menos puntos (una trama demasiado larga se responde con `Frame too long`). Toda la lógica está en `CommandParserBase`, así que parsers de distinto tamaño comparten el mismo código en flash.
+
+== Uso de Memoria
+
+Todos los textos fijos de la librería (nombres de los comandos, uso, ayuda y mensajes de error) y la tabla de comandos se almacenan en la memoria flash (`PROGMEM` y `F()`), por lo que en AVR no se copian a la SRAM al iniciar. La siguiente tabla compara la compilación por defecto (ATmega328P, 2 KB de SRAM) con la versión inicial de la librería, que tenía 12 comandos y guardaba todos sus literales en SRAM. Las cifras se calculan a partir de los literales y las tablas de cada versión, con punteros de 2 bytes; todavía no están contrastadas con `avr-size`:
+
+#align(center)[
+  #table(
+    columns: (auto, auto, auto, auto),
+    inset: 10pt,
+    align: (left, right, right, right),
+    [*Datos*], [*SRAM inicial*], [*SRAM actual*], [*Flash actual*],
+    [Nombres, uso y ayuda de los comandos], table.cell(rowspan: 2, align: horizon + right)[2039 bytes], [0 bytes], [1366 bytes],
+    [Mensajes de error y respuestas fijas], [0 bytes], [629 bytes],
+    [Tabla de descriptores (20 × 12 bytes)], [—], [0 bytes], [240 bytes],
+    [Tabla de hash de los comandos], [—], [0 bytes], [64 bytes],
+    [Velocidades de `SET_BAUD` (9 × 4 bytes)], [—], [0 bytes], [36 bytes],
+    [Tablas de `NumberParser` y `NumberFormatter`], [—], [88 bytes], [—],
+    [*Total*], [*2039 bytes*], [*88 bytes*], [*2335 bytes*],
+  )
+]
+
+La versión inicial no separaba los textos de los comandos de los mensajes, por lo que la primera fila suma ambos: 73 literales distintos más `DEVICE_ID` y el prefijo `ERROR: `. Se liberan así unos 1950 bytes de SRAM. La versión inicial ya ocupaba sus 2039 bytes también en flash, como valor inicial de la SRAM, por lo que la flash sólo crece unos 300 bytes, que corresponden a las tablas y a los textos de los 8 comandos nuevos. El costo es un acceso `pgm_read_*` por lectura.
+
+El consumo real se mide con el sketch de referencia `examples/Footprint`, que registra todos los callbacks y ejecuta los movimientos con `StepEngine`, por lo que enlaza la librería completa. Se compila para un Arduino Uno con los flags por defecto y con `COMMAND_PARSER_STATS` y `COMMAND_PARSER_FIXED_POINT`, y se lee el tamaño con `avr-size`:
+
+```sh
+cd CommandParser/examples/Footprint
+arduino-cli compile -b arduino:avr:uno --library ../.. --output-dir build .
+avr-size -C --mcu=atmega328p build/Footprint.ino.elf
+arduino-cli compile -b arduino:avr:uno --library ../.. --output-dir build-stats \
+  --build-property "compiler.cpp.extra_flags=-DCOMMAND_PARSER_STATS=1 -DCOMMAND_PARSER_FIXED_POINT=1" .
+avr-size -C --mcu=atmega328p build-stats/Footprint.ino.elf
+```
+
+== Compilación en el Host
+
+La carpeta `host` permite compilar la librería en Linux, sin placa, para probarla, medirla o simular movimientos. Contiene un `Arduino.h` mínimo con un `Serial` cuya entrada se inyecta con `Serial.inject()` y cuya salida se obtiene con `Serial.takeOutput()`, y un reloj que sólo avanza con `hostAdvanceMicros()`, por lo que cada ejecución es reproducible. El IDE de Arduino no compila esta carpeta.
+
+```sh
+cd CommandParser/host
+cmake -S . -B build && cmake --build build
+ctest --test-dir build
+printf 'ABSOLUTE_MOVE 10 5 1\nGET_POSITION\n' | build/parser_console
+```
+
+`parser_console` envía cada línea de la entrada estándar al parser y escribe sus respuestas; los movimientos los ejecuta `StepEngine` sobre el reloj simulado. Los flags de la librería se pasan con `-DCOMMAND_PARSER_DEFINITIONS="COMMAND_PARSER_FIXED_POINT=1"`. Otros programas se enlazan con la biblioteca `command_parser`:
+
+```cpp
+#include <CommandParser.h>
+
+CommandParser parser;
+
+int main() {
+  parser.begin();
+  Serial.inject("GET_ID\n");
+  parser.read();
+  std::string response = Serial.takeOutput();  // "ACK GET_ID\r\nDONE GET_ID: ...\r\n"
+}
+```
+
+=== Pruebas
+
+`ctest` ejecuta dos programas de prueba:
+
+- `parser_tests` comprueba por separado el redondeo y los límites de `NumberParser`, que una trama sobreviva a COBS y al CRC y que se rechacen las tramas dañadas, y que el buffer de transmisión conserve el orden al dar la vuelta y descarte y cuente las escrituras que no caben. A través de `read()` comprueba las etiquetas, la separación con `;`, las líneas demasiado largas, el cambio de velocidad con `SET_BAUD` y `KEEP_BAUD` y su vuelta atrás, los callbacks en punto fijo y en `float`, los comandos y respuestas en modo binario, la telemetría y sus muestras descartadas, `defer()` y `complete()`, `GET_STATS`, y la profundidad de la cola de movimientos en cada `ACK` junto con los lotes de `PATH` y sus respuestas `POINT`.
+- `motion_tests` comprueba las velocidades de unión del planificador, que el perfil recorra exactamente cada movimiento sin superar la velocidad ni la aceleración, y que el motor de pasos llegue a cada destino con los pasos y direcciones correctos y en el tiempo que piden la velocidad y la aceleración.
+
+Cada comprobación fallida se imprime con su línea.
+
+=== Benchmarks
+
+La compilación en el host también genera dos programas de medición, que reportan el tiempo por operación (ns/op) y las operaciones por segundo:
+
+- `parser_benchmark` mide cada etapa del parser por separado junto a la función estándar que reemplaza (búsqueda del comando con hash frente a una cadena de `strcmp`, `NumberParser` frente a `strtod`, `NumberFormatter` frente a `snprintf`, codificación de tramas y buffer de transmisión), y luego pasa lotes de cada tipo de comando por `read()`, desde los bytes recibidos hasta la respuesta enviada, en modo texto y binario.
+- `motion_benchmark` mide el planificador, la preparación y el tick del perfil y la interrupción del motor de pasos, y compara el costo medio de `isr()` a velocidades crecientes con su presupuesto, el tiempo entre dos llamadas a `STEP_TICK_RATE` (100 µs por defecto). En el host la fracción del presupuesto es una cota inferior; en una placa se estima escalándola por la relación entre ambos relojes.
+
+Los tiempos son del procesador del host y sirven para comparar cambios entre sí, no para estimar los tiempos en el microcontrolador.